@@ -0,0 +1,191 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+// Compares the generic loop shader with the specialized variants, for every
+// color count, by color-keying a 4K texture into an offscreen framebuffer.
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QImage>
+#include <QOffscreenSurface>
+#include <QOpenGLBuffer>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLVertexArrayObject>
+#include <QRandomGenerator>
+#include <QVector4D>
+#include <cstdio>
+#include "ColorTranslucencyShaderSource.h"
+
+namespace
+{
+    const int WIDTH = 3840;
+    const int HEIGHT = 2160;
+    const int FRAMES = 200;
+    const int MAX_SETS = 10;
+
+    const char *VERTEX_SHADER = R"(#version 140
+in vec4 position;
+in vec4 texcoord;
+out vec2 texcoord0;
+void main() {
+  texcoord0 = texcoord.xy;
+  gl_Position = position;
+}
+)";
+
+    QByteArray readShader(const QString &name)
+    {
+        QFile file(QStringLiteral(COLORTRANSLUCENCY_SHADER_DIR "/") + name);
+        if (!file.open(QFile::ReadOnly))
+            return {};
+        return file.readAll();
+    }
+
+    // Mostly arbitrary pixels, with every fourth one set to one of the targets
+    QImage windowContents(const QVector<QColor> &targets)
+    {
+        QImage image(WIDTH, HEIGHT, QImage::Format_RGBA8888);
+        auto *random = QRandomGenerator::global();
+        for (int y = 0; y < HEIGHT; y++)
+            for (int x = 0; x < WIDTH; x++)
+            {
+                if (random->bounded(4) == 0)
+                    image.setPixelColor(x, y, targets[random->bounded(targets.size())]);
+                else
+                    image.setPixelColor(x, y, QColor::fromRgb(random->generate() | 0xff000000));
+            }
+        return image;
+    }
+
+    double measure(QOpenGLFunctions *gl, const QByteArray &fragmentSource, const QVector<QVector4D> &colors, const QVector<GLfloat> &alphas)
+    {
+        QOpenGLShaderProgram program;
+        program.addShaderFromSourceCode(QOpenGLShader::Vertex, VERTEX_SHADER);
+        program.addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentSource);
+        program.bindAttributeLocation("position", 0);
+        program.bindAttributeLocation("texcoord", 1);
+        if (!program.link())
+        {
+            std::fprintf(stderr, "%s\n", qPrintable(program.log()));
+            return -1.0;
+        }
+
+        program.bind();
+        program.setUniformValue("sampler", 0);
+        program.setUniformValueArray("targetColor", colors.constData(), colors.size());
+        program.setUniformValueArray("targetAlpha", alphas.constData(), alphas.size(), 1);
+        program.setUniformValue("numberOfColors", colors.size());
+
+        // Warm up so that lazy driver work is not measured
+        gl->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        gl->glFinish();
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < FRAMES; i++)
+        {
+            gl->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            gl->glFinish();
+        }
+        const double elapsed = timer.nsecsElapsed() / 1e6 / FRAMES;
+
+        program.release();
+        return elapsed;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    QGuiApplication app(argc, argv);
+
+    QSurfaceFormat format;
+    format.setVersion(3, 2);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+
+    QOpenGLContext context;
+    context.setFormat(format);
+    QOffscreenSurface surface;
+    surface.setFormat(format);
+    surface.create();
+    if (!context.create() || !context.makeCurrent(&surface))
+    {
+        std::fprintf(stderr, "Could not create an OpenGL 3.2 core context\n");
+        return 1;
+    }
+
+    const QByteArray source = readShader(QStringLiteral("colortranslucency_core.frag"));
+    if (source.isEmpty())
+    {
+        std::fprintf(stderr, "Could not read colortranslucency_core.frag from %s\n", COLORTRANSLUCENCY_SHADER_DIR);
+        return 1;
+    }
+
+    QVector<QColor> targets;
+    for (int i = 0; i < MAX_SETS; i++)
+        targets.push_back(QColor::fromHsv(i * 36, 200, 40 + i * 20));
+
+    QOpenGLFunctions *gl = context.functions();
+    QOpenGLFramebufferObject fbo(WIDTH, HEIGHT);
+    fbo.bind();
+    gl->glViewport(0, 0, WIDTH, HEIGHT);
+
+    QOpenGLTexture texture(windowContents(targets));
+    texture.setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+    texture.bind(0);
+
+    const GLfloat quad[] = {
+        -1.0f, -1.0f, 0.0f, 0.0f,
+        1.0f, -1.0f, 1.0f, 0.0f,
+        -1.0f, 1.0f, 0.0f, 1.0f,
+        1.0f, 1.0f, 1.0f, 1.0f,
+    };
+    QOpenGLVertexArrayObject vao;
+    vao.create();
+    vao.bind();
+    QOpenGLBuffer vbo;
+    vbo.create();
+    vbo.bind();
+    vbo.allocate(quad, sizeof(quad));
+    gl->glEnableVertexAttribArray(0);
+    gl->glEnableVertexAttribArray(1);
+    gl->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), nullptr);
+    gl->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), reinterpret_cast<void *>(2 * sizeof(GLfloat)));
+
+    std::printf("%s, %dx%d, %d frames\n", reinterpret_cast<const char *>(gl->glGetString(GL_RENDERER)), WIDTH, HEIGHT, FRAMES);
+    std::printf("colors  generic (ms/frame)  specialized (ms/frame)\n");
+    for (int count = 0; count <= MAX_SETS; count++)
+    {
+        QVector<QVector4D> colors;
+        QVector<GLfloat> alphas;
+        for (int i = 0; i < count; i++)
+        {
+            colors.push_back(QVector4D(targets[i].redF(), targets[i].greenF(), targets[i].blueF(), 1.0f));
+            alphas.push_back(0.5f);
+        }
+
+        const double generic = measure(gl, ColorTranslucencyShaderSource::specialize(source, ColorTranslucencyShaderSource::GENERIC), colors, alphas);
+        const double specialized = measure(gl, ColorTranslucencyShaderSource::specialize(source, count), colors, alphas);
+        std::printf("%6d  %18.3f  %22.3f\n", count, generic, specialized);
+    }
+
+    return 0;
+}
@@ -18,18 +18,57 @@
  */
 
 #include "ColorTranslucencyEffect.h"
+#include "ColorTranslucencyLogging.h"
 #include <kwingltexture.h>
+#include <algorithm>
+#include <climits>
+#include <utility>
 #include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusConnectionInterface>
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusPendingCallWatcher>
+#include <QtDBus/QDBusPendingReply>
+#include <QDateTime>
 #include <QDBusError>
+#include <QDir>
+#include <QMetaMethod>
+#include <QStandardPaths>
 
-#if KWIN_EFFECT_API_VERSION >= 235
-#include <KX11Extras>
-#else
-#include <kwindowsystem.h>
-#endif
+namespace
+{
+    // Pre-existing windows adopted per frame when initialization is deferred
+    constexpr int WINDOWS_PER_FRAME = 4;
+
+    // Windows drawn this recently stay awake even if they look hidden,
+    // an overview may be showing minimized windows or other desktops
+    constexpr qint64 DRAWN_GRACE = 1000;
+    // Covering has to last this long, windows dragged over others do not churn
+    constexpr qint64 OCCLUSION_DELAY = 1000;
+
+    // A window counts as drawn scaled down below the first scale and as
+    // drawn at full size again above the second one
+    constexpr double SCALED_DOWN_ENTER = 0.6;
+    constexpr double SCALED_DOWN_LEAVE = 0.8;
+
+    // Damage waiting for the tile mask is merged into its bounding rectangle
+    // beyond this many rectangles, redrawing the mask only uses the latter
+    constexpr int MASK_DAMAGE_RECTS = 16;
+
+    const char *const SUSPEND_REASON_NAMES[] = {"minimized", "otherDesktop", "otherActivity", "occluded", "idle"};
 
-QVector<QColor> ColorTranslucencyEffect::m_activeColors;
-QVector<int> ColorTranslucencyEffect::m_activeAlphas;
+    // Whether two target lists key the same pixels, whatever alpha they get
+    bool sameColors(const ColorTranslucencyTargets &a, const ColorTranslucencyTargets &b)
+    {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const auto &x, const auto &y) {
+            return x.color == y.color && x.tolerance == y.tolerance;
+        });
+    }
+}
+
+QRectF operator*(QRect r, qreal scale) { return {r.x() * scale, r.y() * scale, r.width() * scale, r.height() * scale}; }
+QRectF operator*(QRectF r, qreal scale) { return {r.x() * scale, r.y() * scale, r.width() * scale, r.height() * scale}; }
+QRect toRect(const QRectF &r) { return {(int)r.x(), (int)r.y(), (int)r.width(), (int)r.height()}; }
+const QRect &toRect(const QRect &r) { return r; }
 
 ColorTranslucencyEffect::ColorTranslucencyEffect()
 #if KWIN_EFFECT_API_VERSION >= 236
@@ -38,198 +77,816 @@ ColorTranslucencyEffect::ColorTranslucencyEffect()
     : KWin::DeformEffect()
 #endif
 {
-    qDebug() << "ColorTranslucencyEffect::ColorTranslucencyEffect: effect created";
+    qCDebug(COLORTRANSLUCENCY_LIFECYCLE) << "ColorTranslucencyEffect::ColorTranslucencyEffect: effect created";
+    connect(&m_shaderWatcher, &QFileSystemWatcher::fileChanged, this, &ColorTranslucencyEffect::shaderFilesChanged);
+    connect(&m_shaderWatcher, &QFileSystemWatcher::directoryChanged, this, &ColorTranslucencyEffect::shaderFilesChanged);
+    m_clock.start();
+    m_governor = &governorFor(nullptr);
+    m_probeTimer.setSingleShot(true);
+    connect(&m_probeTimer, &QTimer::timeout, this, &ColorTranslucencyEffect::rearmProbes);
+    connect(&m_visibilityTimer, &QTimer::timeout, this, &ColorTranslucencyEffect::updateVisibility);
+    m_visibilityUpdate.setSingleShot(true);
+    connect(&m_visibilityUpdate, &QTimer::timeout, this, &ColorTranslucencyEffect::updateVisibility);
+    m_configLoader.setMaxThreadCount(1);
+    m_previewWatcher.setConnection(QDBusConnection::sessionBus());
+    m_previewWatcher.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(&m_previewWatcher, &QDBusServiceWatcher::serviceUnregistered, this, &ColorTranslucencyEffect::end_preview);
     reconfigure(ReconfigureAll);
+    registerDBus();
+
+    connect(KWin::effects, &KWin::EffectsHandler::windowAdded, this, &ColorTranslucencyEffect::slotWindowAdded);
+    connect(KWin::effects, &KWin::EffectsHandler::windowDeleted, this, &ColorTranslucencyEffect::slotWindowRemoved);
+    connect(KWin::effects, &KWin::EffectsHandler::windowDamaged, this, &ColorTranslucencyEffect::slotWindowDamaged);
+#if KWIN_EFFECT_API_VERSION >= 234
+    connect(KWin::effects, &KWin::EffectsHandler::screenRemoved, this, &ColorTranslucencyEffect::slotScreenRemoved);
+#endif
+    connect(KWin::effects, &KWin::EffectsHandler::windowFullScreenChanged, this, &ColorTranslucencyEffect::updateBypass);
+    connect(KWin::effects, &KWin::EffectsHandler::windowMaximizedStateChanged, this,
+            [this](KWin::EffectWindow *w) { updateBypass(w); });
+    connect(KWin::effects, &KWin::EffectsHandler::windowFrameGeometryChanged, this,
+            [this](KWin::EffectWindow *w) { updateBypass(w); });
 
+    // Whatever can hide or uncover a window
+    connect(KWin::effects, &KWin::EffectsHandler::windowMinimized, this, &ColorTranslucencyEffect::scheduleVisibilityUpdate);
+    connect(KWin::effects, &KWin::EffectsHandler::windowUnminimized, this, &ColorTranslucencyEffect::scheduleVisibilityUpdate);
+    connect(KWin::effects, qOverload<int, int, KWin::EffectWindow *>(&KWin::EffectsHandler::desktopChanged), this,
+            &ColorTranslucencyEffect::scheduleVisibilityUpdate);
+    connect(KWin::effects, &KWin::EffectsHandler::desktopPresenceChanged, this, &ColorTranslucencyEffect::scheduleVisibilityUpdate);
+    connect(KWin::effects, &KWin::EffectsHandler::currentActivityChanged, this, &ColorTranslucencyEffect::scheduleVisibilityUpdate);
+    connect(KWin::effects, &KWin::EffectsHandler::windowFrameGeometryChanged, this, &ColorTranslucencyEffect::scheduleVisibilityUpdate);
+    connect(KWin::effects, &KWin::EffectsHandler::stackingOrderChanged, this, &ColorTranslucencyEffect::scheduleVisibilityUpdate);
+    connect(KWin::effects, &KWin::EffectsHandler::activeFullScreenEffectChanged, this, &ColorTranslucencyEffect::scheduleVisibilityUpdate);
+
+    if (!m_snapshot->deferredInitialization)
+    {
+        initializeShaders();
+        if (!m_shaderManager.IsValid())
+            return;
+        for (auto win : KWin::effects->stackingOrder())
+            slotWindowAdded(win);
+        return;
+    }
+
+    // Shaders are built and existing windows redirected from the paint loop,
+    // spread over the first frames so that loading the effect never stalls.
+    for (auto win : KWin::effects->stackingOrder())
+        m_pendingWindows.enqueue(win);
+    if (!m_pendingWindows.isEmpty())
+        KWin::effects->addRepaintFull();
+}
+
+void ColorTranslucencyEffect::registerDBus()
+{
     auto connection = QDBusConnection::sessionBus();
     if (!connection.isConnected())
     {
-        qWarning("ColorTranslucency: Cannot connect to the D-Bus session bus.\n");
+        qCWarning(COLORTRANSLUCENCY, "ColorTranslucency: Cannot connect to the D-Bus session bus.\n");
+        return;
     }
-    else
+
+    if (!connection.registerObject("/ColorTranslucencyEffect", this, QDBusConnection::ExportAllSlots | QDBusConnection::ExportAllSignals))
     {
-        if (!connection.registerService("org.kde.ColorTranslucency"))
-        {
-            qWarning("%s\n", qPrintable(connection.lastError().message()));
-        }
-        else
-        {
-            if (!connection.registerObject("/ColorTranslucencyEffect", this, QDBusConnection::ExportAllSlots))
-            {
-                qWarning("%s\n", qPrintable(connection.lastError().message()));
-            }
-        }
+        qCWarning(COLORTRANSLUCENCY, "%s\n", qPrintable(connection.lastError().message()));
+        return;
     }
 
-    if (m_shaderManager.IsValid())
+    // registerService() waits for the bus daemon, ask for the name without blocking
+    auto call = connection.interface()->asyncCall(QStringLiteral("RequestName"), QStringLiteral("org.kde.ColorTranslucency"), 0u);
+    auto watcher = new QDBusPendingCallWatcher(call, this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [](QDBusPendingCallWatcher *watcher)
     {
-#if KWIN_EFFECT_API_VERSION >= 235
-        const auto &windowList = KX11Extras::windows();
-#else
-        const auto &windowList = KWindowSystem::windows();
-#endif
-        for (const auto &id : windowList)
-            if (auto win = KWin::effects->findWindow(id))
-                windowAdded(win);
-        connect(KWin::effects, &KWin::EffectsHandler::windowAdded, this, &ColorTranslucencyEffect::windowAdded);
-        connect(KWin::effects, &KWin::EffectsHandler::windowDeleted, this, &ColorTranslucencyEffect::windowRemoved);
-    }
+        QDBusPendingReply<uint> reply = *watcher;
+        if (reply.isError())
+            qCWarning(COLORTRANSLUCENCY, "%s\n", qPrintable(reply.error().message()));
+        else if (reply.value() != 1 && reply.value() != 4) // primary owner, already owner
+            qCWarning(COLORTRANSLUCENCY, "ColorTranslucency: the D-Bus name org.kde.ColorTranslucency is already taken.\n");
+        watcher->deleteLater();
+    });
 }
 
-ColorTranslucencyEffect::~ColorTranslucencyEffect() = default;
-
-void ColorTranslucencyEffect::windowAdded(KWin::EffectWindow *w)
+void ColorTranslucencyEffect::initializeShaders()
 {
-    auto name = w->windowClass();
-    qDebug() << "ColorTranslucencyEffect::windowAdded: " << name;
-    auto r = m_managed.insert(w);
-    if (r.second)
+    if (m_shaderManager.IsInitialized())
+        return;
+
+    KWin::effects->makeOpenGLContextCurrent();
+    for (auto &[screen, governor] : m_governors)
+        governor->Initialize();
+    if (m_shaderManager.Initialize())
     {
-        redirect(w);
-        setShader(w, m_shaderManager.GetShader().get());
+        updateDegradedProfiles();
+        return;
     }
-}
 
-void ColorTranslucencyEffect::windowRemoved(KWin::EffectWindow *w)
-{
-    qDebug() << "ColorTranslucencyEffect::windowRemoved: " << w->windowClass();
-    m_managed.erase(w);
-    unredirect(w);
+    // Windows were redirected optimistically, give them back to KWin
+    for (auto &[w, state] : m_managed)
+        updateWindowState(const_cast<KWin::EffectWindow *>(w), state);
 }
 
-QVector<QColor> activeTargetColors()
+void ColorTranslucencyEffect::updateShaderWatcher()
 {
-    QVector<QColor> colors;
+    if (!m_shaderWatcher.files().isEmpty())
+        m_shaderWatcher.removePaths(m_shaderWatcher.files());
+    if (!m_shaderWatcher.directories().isEmpty())
+        m_shaderWatcher.removePaths(m_shaderWatcher.directories());
+    if (!m_liveShaderReload)
+        return;
 
-    if (ColorTranslucencyConfig::enableColor_1())
-    {
-        colors.push_back(ColorTranslucencyConfig::targetColor_1());
-    }
-    if (ColorTranslucencyConfig::enableColor_2())
-    {
-        colors.push_back(ColorTranslucencyConfig::targetColor_2());
-    }
-    if (ColorTranslucencyConfig::enableColor_3())
-    {
-        colors.push_back(ColorTranslucencyConfig::targetColor_3());
-    }
-    if (ColorTranslucencyConfig::enableColor_4())
-    {
-        colors.push_back(ColorTranslucencyConfig::targetColor_4());
-    }
-    if (ColorTranslucencyConfig::enableColor_5())
-    {
-        colors.push_back(ColorTranslucencyConfig::targetColor_5());
-    }
-    if (ColorTranslucencyConfig::enableColor_6())
+    // Directories too, editors usually replace files instead of writing them
+    const QStringList directories = QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, QStringLiteral("kwin/shaders"),
+                                                              QStandardPaths::LocateDirectory);
+    for (const auto &directory : directories)
     {
-        colors.push_back(ColorTranslucencyConfig::targetColor_6());
+        m_shaderWatcher.addPath(directory);
+        for (const auto &file : QDir(directory).entryList({QStringLiteral("colortranslucency*.frag")}, QDir::Files))
+            m_shaderWatcher.addPath(directory + QLatin1Char('/') + file);
     }
-    if (ColorTranslucencyConfig::enableColor_7())
-    {
-        colors.push_back(ColorTranslucencyConfig::targetColor_7());
-    }
-    if (ColorTranslucencyConfig::enableColor_8())
-    {
-        colors.push_back(ColorTranslucencyConfig::targetColor_8());
-    }
-    if (ColorTranslucencyConfig::enableColor_9())
-    {
-        colors.push_back(ColorTranslucencyConfig::targetColor_9());
-    }
-    if (ColorTranslucencyConfig::enableColor_10())
+}
+
+void ColorTranslucencyEffect::shaderFilesChanged()
+{
+    qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyEffect::shaderFilesChanged: reloading shaders";
+    updateShaderWatcher();
+    m_shaderManager.ReloadSources();
+    KWin::effects->addRepaintFull();
+}
+
+void ColorTranslucencyEffect::adoptPendingWindows()
+{
+    for (int adopted = 0; adopted < WINDOWS_PER_FRAME && !m_pendingWindows.isEmpty();)
     {
-        colors.push_back(ColorTranslucencyConfig::targetColor_10());
+        const QPointer<KWin::EffectWindow> win = m_pendingWindows.dequeue();
+        if (!win || win->isDeleted())
+            continue;
+        slotWindowAdded(win);
+        adopted++;
     }
 
-    return colors;
+    if (!m_pendingWindows.isEmpty())
+        KWin::effects->addRepaintFull();
 }
 
-QVector<int> activeTargetAlphas()
+ColorTranslucencyEffect::~ColorTranslucencyEffect()
 {
-    QVector<int> alphas;
+    // A load in flight posts back to this object
+    m_configLoader.waitForDone();
+}
 
-    if (ColorTranslucencyConfig::enableColor_1())
+void ColorTranslucencyEffect::slotWindowAdded(KWin::EffectWindow *w)
+{
+    auto name = w->windowClass();
+    qCDebugLimited(COLORTRANSLUCENCY_LIFECYCLE) << "ColorTranslucencyEffect::slotWindowAdded:" << name;
+    if (!m_shaderManager.IsValid())
+        return;
+    auto r = m_managed.try_emplace(w);
+    if (r.second)
     {
-        alphas.push_back(ColorTranslucencyConfig::targetAlpha_1());
+        r.first->second.lastDrawn = m_clock.elapsed();
+        watchMatch(w, r.first->second);
+        matchWindow(w, r.first->second);
+        updateWindowState(w, r.first->second);
+        Q_EMIT windowAdded(windowRecord(w, r.first->second));
     }
-    if (ColorTranslucencyConfig::enableColor_2())
+}
+
+void ColorTranslucencyEffect::slotWindowRemoved(KWin::EffectWindow *w)
+{
+    qCDebugLimited(COLORTRANSLUCENCY_LIFECYCLE) << "ColorTranslucencyEffect::slotWindowRemoved:" << w->windowClass();
+    auto it = m_managed.find(w);
+    if (it == m_managed.end())
+        return;
+
+    if (it->second.redirected)
+        unredirect(w);
+    m_offscreenBytes -= it->second.offscreenBytes;
+    m_probe.Recycle(it->second.probeQuery);
+    if (m_maskWindow == w)
+        m_maskWindow = nullptr;
+    // Closed windows may already be held by another parent
+    if (it->second.matchSignals)
     {
-        alphas.push_back(ColorTranslucencyConfig::targetAlpha_2());
+        const auto source = std::find_if(m_matchSources.begin(), m_matchSources.end(),
+                                         [w](const auto &entry) { return entry.second == w; });
+        if (source != m_matchSources.end())
+            m_matchSources.erase(source);
     }
-    if (ColorTranslucencyConfig::enableColor_3())
+    Q_EMIT windowRemoved(it->second.id);
+    m_managed.erase(it);
+}
+
+void ColorTranslucencyEffect::watchMatch(KWin::EffectWindow *w, ColorTranslucencyWindow &state)
+{
+    // The effect API has no signal for class or caption changes, but the
+    // window an EffectWindow wraps is its parent and has them. Its class is
+    // not exported, so the signals are resolved through its meta object.
+    static const QMetaMethod slot = staticMetaObject.method(staticMetaObject.indexOfSlot("slotWindowMatchChanged()"));
+    QObject *window = w->parent();
+    const auto connectSignal = [this, window](const char *name) {
+        const int index = window->metaObject()->indexOfSignal(name);
+        return index >= 0 && connect(window, window->metaObject()->method(index), this, slot);
+    };
+    state.matchSignals = window && connectSignal("windowClassChanged()") && connectSignal("captionChanged()");
+    if (state.matchSignals)
+        m_matchSources.insert_or_assign(window, w);
+    else
+        qCDebug(COLORTRANSLUCENCY_LIFECYCLE) << "ColorTranslucencyEffect::watchMatch: no change signals, checking" << w->windowClass() << "on damage";
+}
+
+void ColorTranslucencyEffect::slotWindowMatchChanged()
+{
+    const auto source = m_matchSources.find(sender());
+    if (source == m_matchSources.end())
+        return;
+    const auto it = m_managed.find(source->second);
+    if (it != m_managed.end())
+        rematchWindow(source->second, it->second);
+}
+
+void ColorTranslucencyEffect::rematchWindow(KWin::EffectWindow *w, ColorTranslucencyWindow &state)
+{
+    // The rules are only evaluated again when what they look at changed
+    if (state.windowClass == w->windowClass() && (!m_snapshot->matchCaptions || state.caption == w->caption()))
+        return;
+
+    const bool changed = matchWindow(w, state);
+    updateWindowState(w, state);
+    w->addRepaintFull();
+    if (changed)
+        Q_EMIT matchChanged(windowRecord(w, state));
+}
+
+void ColorTranslucencyEffect::slotWindowDamaged(KWin::EffectWindow *w, const QRegion &region)
+{
+    const auto it = m_managed.find(w);
+    if (it != m_managed.end() && !it->second.matchSignals)
+        rematchWindow(w, it->second);
+    if (it == m_managed.end() || !it->second.included)
+        return;
+
+    // Damage is relative to the frame, the mask to the expanded geometry.
+    // Moves and restacks do not damage the window, so they keep the mask.
+    auto &state = it->second;
+    if (m_tileOpaqueRegions)
     {
-        alphas.push_back(ColorTranslucencyConfig::targetAlpha_3());
+        const QPoint frameOffset = toRect(w->frameGeometry()).topLeft() - toRect(w->expandedGeometry()).topLeft();
+        state.maskDamage += region.translated(frameOffset);
+        if (state.maskDamage.rectCount() > MASK_DAMAGE_RECTS)
+            state.maskDamage = state.maskDamage.boundingRect();
     }
-    if (ColorTranslucencyConfig::enableColor_4())
+    if (!m_contentProbing)
+        return;
+
+    state.probePending = true;
+    if (!state.probeEmpty)
+        return;
+
+    // New content may show a target color again. The damage repaints the
+    // window, which probes it right away unless the rate limit says to wait.
+    const qint64 wait = state.lastProbe + m_probeInterval - m_clock.elapsed();
+    if (wait > 0 && (!m_probeTimer.isActive() || m_probeTimer.remainingTime() > wait))
+        m_probeTimer.start(int(wait));
+}
+
+void ColorTranslucencyEffect::rearmProbes()
+{
+    const qint64 now = m_clock.elapsed();
+    qint64 nextWait = -1;
+    for (auto &[w, state] : m_managed)
     {
-        alphas.push_back(ColorTranslucencyConfig::targetAlpha_4());
+        if (!state.probeEmpty || !state.probePending)
+            continue;
+
+        const qint64 wait = state.lastProbe + m_probeInterval - now;
+        if (wait > 0)
+        {
+            nextWait = nextWait < 0 ? wait : std::min(nextWait, wait);
+            continue;
+        }
+
+        // Probed from what KWin draws, the window stays unredirected
+        const_cast<KWin::EffectWindow *>(w)->addRepaintFull();
     }
-    if (ColorTranslucencyConfig::enableColor_5())
+
+    if (nextWait > 0)
+        m_probeTimer.start(int(nextWait));
+}
+
+void ColorTranslucencyEffect::readTileMask()
+{
+    QRect dirtyTiles;
+    QBitArray tiles;
+    if (!m_tileMask.Read(dirtyTiles, tiles))
+        return;
+
+    const auto it = m_managed.find(m_maskWindow);
+    m_maskWindow = nullptr;
+    if (it == m_managed.end())
+        return;
+
+    // Only the tiles that were redrawn change
+    const int size = ColorTranslucencyTileMask::TILE_SIZE;
+    QRegion keyed = it->second.keyedTiles - QRect(dirtyTiles.topLeft() * size, dirtyTiles.size() * size);
+    for (int y = 0; y < dirtyTiles.height(); y++)
+        for (int x = 0; x < dirtyTiles.width(); x++)
+            if (tiles.testBit(y * dirtyTiles.width() + x))
+                keyed += QRect((dirtyTiles.x() + x) * size, (dirtyTiles.y() + y) * size, size, size);
+
+    it->second.keyedTiles = keyed;
+    it->second.maskPending = QRegion();
+    it->second.maskValid = true;
+}
+
+void ColorTranslucencyEffect::readProbes()
+{
+    for (auto &[w, state] : m_managed)
     {
-        alphas.push_back(ColorTranslucencyConfig::targetAlpha_5());
+        quint64 samples = 0;
+        if (!state.probeQuery || !m_probe.Read(state.probeQuery, samples))
+            continue;
+
+        m_probe.Recycle(state.probeQuery);
+        state.probeQuery = 0;
+        state.probeMatches = samples;
+        qCTrace() << "ColorTranslucencyEffect::readProbes:" << state.title << samples << "matching samples";
+        if ((samples > 0) != state.probeEmpty)
+            continue;
+
+        // Nothing to key lets KWin draw the window without the extra pass,
+        // a target color showing up again keys it again
+        state.probeEmpty = samples == 0;
+        if (state.probeEmpty)
+            m_probeUnredirects++;
+        updateWindowState(const_cast<KWin::EffectWindow *>(w), state);
+        const_cast<KWin::EffectWindow *>(w)->addRepaintFull();
     }
-    if (ColorTranslucencyConfig::enableColor_6())
+}
+
+bool ColorTranslucencyEffect::matchWindow(KWin::EffectWindow *w, ColorTranslucencyWindow &state)
+{
+    const QString previousTitle = state.title;
+    const bool wasIncluded = state.included;
+    const int previousRule = state.rule;
+    const int previousProfile = state.profile;
+
+    state.windowClass = w->windowClass();
+    state.title = get_window_title(w);
+    if (!state.id)
+        state.id = ColorTranslucencyTrace::Global().NewWindowId();
+    if (ColorTranslucencyTrace::Global().IsEnabled())
+        ColorTranslucencyTrace::Global().NameWindow(state.id, state.windowClass);
+
+    ColorTranslucencyRuleSubject subject;
+    subject.windowClass = state.title;
+    subject.fullClass = state.windowClass;
+    subject.role = w->windowRole();
+    if (m_snapshot->matchCaptions)
+        subject.caption = state.caption = w->caption();
+    else
+        state.caption.clear();
+
+    using Rules = ColorTranslucencyRules;
+    subject.types = (w->isNormalWindow() ? Rules::TypeNormal : 0) | (w->isDialog() ? Rules::TypeDialog : 0) |
+                    (w->isUtility() ? Rules::TypeUtility : 0) | (w->isDock() ? Rules::TypeDock : 0) |
+                    (w->isDesktop() ? Rules::TypeDesktop : 0) | (w->isToolbar() ? Rules::TypeToolbar : 0) |
+                    (w->isMenu() || w->isDropdownMenu() || w->isPopupMenu() ? Rules::TypeMenu : 0) |
+                    (w->isSplash() ? Rules::TypeSplash : 0) |
+                    (w->isNotification() || w->isCriticalNotification() ? Rules::TypeNotification : 0) |
+                    (w->isTooltip() ? Rules::TypeTooltip : 0);
+
+    const auto match = m_snapshot->rules.Evaluate(subject);
+    state.included = match.included;
+    state.rule = match.rule;
+
+    // The first profile whose rule matches picks the colors, and includes the
+    // window unless the exclusion list says otherwise
+    state.profile = 0;
+    for (size_t i = 0; i < m_snapshot->profileMatchers.size(); i++)
     {
-        alphas.push_back(ColorTranslucencyConfig::targetAlpha_6());
+        if (m_snapshot->profileMatchers[i].Evaluate(subject).included)
+        {
+            state.profile = int(i) + 1;
+            state.included = match.rule < 0 || match.included;
+            break;
+        }
     }
-    if (ColorTranslucencyConfig::enableColor_7())
+
+    return state.title != previousTitle || state.included != wasIncluded || state.rule != previousRule ||
+           state.profile != previousProfile;
+}
+
+void ColorTranslucencyEffect::updateWindowState(KWin::EffectWindow *w, ColorTranslucencyWindow &state)
+{
+    state.bypassed = shouldBypass(w);
+    state.keyed = state.included && !state.bypassed && !state.throttled && !state.probeEmpty && !state.suspended && m_shaderManager.IsValid();
+    if (state.keyed && !state.redirected)
     {
-        alphas.push_back(ColorTranslucencyConfig::targetAlpha_7());
+        redirect(w);
+        setShader(w, m_shaderManager.GetShader());
+        state.redirects++;
     }
-    if (ColorTranslucencyConfig::enableColor_8())
+    else if (!state.keyed && state.redirected)
     {
-        alphas.push_back(ColorTranslucencyConfig::targetAlpha_8());
+        unredirect(w);
+        state.unredirects++;
     }
-    if (ColorTranslucencyConfig::enableColor_9())
+    state.redirected = state.keyed;
+    updateOffscreenBytes(w, state);
+}
+
+void ColorTranslucencyEffect::updateOffscreenBytes(KWin::EffectWindow *w, ColorTranslucencyWindow &state)
+{
+    quint64 bytes = 0;
+    if (state.redirected)
     {
-        alphas.push_back(ColorTranslucencyConfig::targetAlpha_9());
+        // What OffscreenEffect allocates for the window, RGBA8 at the render scale
+#if KWIN_EFFECT_API_VERSION >= 234
+        const qreal scale = KWin::effects->renderTargetScale();
+#else
+        const qreal scale = 1.0;
+#endif
+        const QRect expanded = toRect(w->expandedGeometry());
+        bytes = quint64(4.0 * expanded.width() * scale * expanded.height() * scale);
     }
-    if (ColorTranslucencyConfig::enableColor_10())
+
+    m_offscreenBytes = m_offscreenBytes - state.offscreenBytes + bytes;
+    m_peakOffscreenBytes = std::max(m_peakOffscreenBytes, m_offscreenBytes);
+    state.offscreenBytes = bytes;
+    state.peakOffscreenBytes = std::max(state.peakOffscreenBytes, bytes);
+}
+
+ColorTranslucencyGovernor &ColorTranslucencyEffect::governorFor(const KWin::EffectScreen *screen)
+{
+    auto &governor = m_governors[screen];
+    if (governor)
+        return *governor;
+
+    governor = std::make_unique<ColorTranslucencyGovernor>();
+    governor->SetBudget(m_frameBudget);
+    governor->SetForcedLevel(m_forcedLevel);
+    const ColorTranslucencyGovernor *output = governor.get();
+    governor->SetGpuTimeListener([this, output](const void *owner, quint64 frame, qint64 nanoseconds) {
+        m_frameStats.AddGpuTime(output, frame, nanoseconds);
+        // The window may be gone by the time its query is read back
+        const auto it = m_managed.find(static_cast<const KWin::EffectWindow *>(owner));
+        if (it != m_managed.end())
+            it->second.gpuTime += nanoseconds;
+    });
+    return *governor;
+}
+
+void ColorTranslucencyEffect::slotScreenRemoved(KWin::EffectScreen *screen)
+{
+    const auto it = m_governors.find(screen);
+    if (it == m_governors.end())
+        return;
+
+    if (m_governor == it->second.get())
+        m_governor = &governorFor(nullptr);
+    // Deletes the governor's timer queries
+    KWin::effects->makeOpenGLContextCurrent();
+    m_governors.erase(it);
+}
+
+void ColorTranslucencyEffect::updateThrottling()
+{
+    // Windows are only limited by the governor of the output they are on
+    std::map<const ColorTranslucencyGovernor *, int> allowances;
+    const auto order = KWin::effects->stackingOrder();
+    for (auto it = order.crbegin(); it != order.crend(); ++it)
     {
-        alphas.push_back(ColorTranslucencyConfig::targetAlpha_10());
+        const auto found = m_managed.find(*it);
+        if (found == m_managed.end() || !found->second.included)
+            continue;
+
+#if KWIN_EFFECT_API_VERSION >= 234
+        const auto governor = m_governors.find((*it)->screen());
+        const ColorTranslucencyGovernor &owner = governor != m_governors.end() ? *governor->second : *m_governor;
+#else
+        const ColorTranslucencyGovernor &owner = *m_governor;
+#endif
+        const auto level = owner.GetLevel();
+        int &allowed = allowances.try_emplace(&owner, level == ColorTranslucencyGovernor::LevelDisabled ? 0
+                                                      : level == ColorTranslucencyGovernor::LevelLimited ? m_governorWindowLimit
+                                                                                                          : INT_MAX).first->second;
+
+        // Only windows that would be keyed use up the allowance
+        auto &state = found->second;
+        const bool candidate = !state.bypassed && !state.probeEmpty && !state.suspended;
+        const bool throttled = candidate && allowed <= 0;
+        if (candidate && allowed > 0)
+            allowed--;
+
+        if (state.throttled != throttled)
+        {
+            state.throttled = throttled;
+            updateWindowState(*it, state);
+        }
     }
+}
 
-    return alphas;
+bool ColorTranslucencyEffect::shouldBypass(const KWin::EffectWindow *w) const
+{
+    return (m_bypassFullscreen && w->isFullScreen()) || (m_bypassMaximized && isMaximized(w));
 }
 
-QVector<QColor> ColorTranslucencyEffect::getActiveColors()
+void ColorTranslucencyEffect::updateBypass(KWin::EffectWindow *w)
 {
-    return m_activeColors;
+    // Geometry changes come in bursts while dragging, only a changed decision costs anything
+    const auto it = m_managed.find(w);
+    if (it != m_managed.end() && it->second.included && it->second.bypassed != shouldBypass(w))
+        updateWindowState(w, it->second);
 }
 
-QVector<int> ColorTranslucencyEffect::getActiveAlphas()
+void ColorTranslucencyEffect::setSuspended(KWin::EffectWindow *w, ColorTranslucencyWindow &state, int reasons)
 {
-    return m_activeAlphas;
+    if (reasons == state.suspended)
+        return;
+
+    for (size_t bit = 0; bit < m_suspendsByReason.size(); bit++)
+        if ((reasons & ~state.suspended) & (1 << bit))
+            m_suspendsByReason[bit]++;
+    if (!state.suspended)
+        m_suspends++;
+    else if (!reasons)
+        m_resumes++;
+
+    // Unredirecting is what makes KWin free the offscreen texture, redirecting
+    // again rebuilds it on the next draw
+    const bool wasRedirected = state.redirected;
+    state.suspended = reasons;
+    updateWindowState(w, state);
+    if (wasRedirected && !state.redirected)
+        m_evictions++;
+}
+
+void ColorTranslucencyEffect::resumeDrawn(KWin::EffectWindow *w, ColorTranslucencyWindow &state)
+{
+    // Being drawn proves every reason wrong except covering, which does not stop KWin
+    state.lastDrawn = m_clock.elapsed();
+    setSuspended(w, state, state.suspended & SuspendOccluded);
+}
+
+void ColorTranslucencyEffect::scheduleVisibilityUpdate()
+{
+    // Moving a window signals every step, one pass covers all of them
+    if (m_visibilityTimer.isActive())
+        m_visibilityUpdate.start();
+}
+
+void ColorTranslucencyEffect::updateVisibility()
+{
+    const qint64 now = m_clock.elapsed();
+    // Transformed windows no longer cover what their geometry says
+    const bool transformed = KWin::effects->activeFullScreenEffect() != nullptr;
+
+    QRegion covered;
+    const auto order = KWin::effects->stackingOrder();
+    for (auto it = order.crbegin(); it != order.crend(); ++it)
+    {
+        KWin::EffectWindow *w = *it;
+        const bool shown = !w->isDeleted() && !w->isMinimized() && w->isOnCurrentDesktop() && w->isOnCurrentActivity();
+
+        const auto found = m_managed.find(w);
+        if (found != m_managed.end() && found->second.included)
+        {
+            auto &state = found->second;
+            int hidden = 0;
+            if (now - state.lastDrawn >= DRAWN_GRACE)
+            {
+                if (w->isMinimized())
+                    hidden |= SuspendMinimized;
+                if (!w->isOnCurrentDesktop())
+                    hidden |= SuspendOtherDesktop;
+                if (!w->isOnCurrentActivity())
+                    hidden |= SuspendOtherActivity;
+            }
+
+            const bool occluded = shown && !transformed && (QRegion(toRect(w->expandedGeometry())) - covered).isEmpty();
+            if (!occluded)
+                state.occludedSince = -1;
+            else if (state.occludedSince < 0)
+                state.occludedSince = now;
+            if (occluded && now - state.occludedSince >= OCCLUSION_DELAY)
+                hidden |= SuspendOccluded;
+
+            // KWin does not draw a visible window that does not change either,
+            // so only hidden windows count as idle
+            int reasons = m_suspendHidden ? hidden : 0;
+            if (hidden && m_evictionDelay > 0 && now - state.lastDrawn >= m_evictionDelay)
+                reasons |= SuspendIdle;
+
+            setSuspended(w, state, reasons);
+        }
+
+        // Only plain opaque windows are trusted to hide what is below them
+        const bool keyed = found != m_managed.end() && found->second.keyed;
+        if (shown && !keyed && !w->hasAlpha() && w->opacity() >= 1.0)
+            covered += toRect(w->frameGeometry());
+    }
 }
 
 void ColorTranslucencyEffect::reconfigure(ReconfigureFlags flags)
 {
     Q_UNUSED(flags)
-    ColorTranslucencyConfig::self()->read();
+    const ColorTranslucencyTraceSpan span("ColorTranslucencyEffect::reconfigure");
+
+    // The first configuration is needed right away to set the effect up
+    if (!m_snapshot)
+        applySnapshot(ColorTranslucencySnapshot::Load());
+    else if (m_loading)
+        m_loadAgain = true;
+    else
+        loadSnapshot();
+}
+
+void ColorTranslucencyEffect::loadSnapshot()
+{
+    m_loading = true;
+    m_configLoader.start([this]() {
+        const ColorTranslucencyTraceSpan span("ColorTranslucencySnapshot::Load");
+        auto snapshot = ColorTranslucencySnapshot::Load();
+        QMetaObject::invokeMethod(
+            this, [this, snapshot = std::move(snapshot)]() mutable { snapshotLoaded(std::move(snapshot)); }, Qt::QueuedConnection);
+    });
+}
+
+void ColorTranslucencyEffect::snapshotLoaded(std::shared_ptr<const ColorTranslucencySnapshot> snapshot)
+{
+    m_loading = false;
+    applySnapshot(std::move(snapshot));
+
+    // Saved again while this one was loading
+    if (std::exchange(m_loadAgain, false))
+        loadSnapshot();
+}
+
+void ColorTranslucencyEffect::applySnapshot(std::shared_ptr<const ColorTranslucencySnapshot> snapshot)
+{
+    const ColorTranslucencyTraceSpan span("ColorTranslucencyEffect::applySnapshot");
+    static const ColorTranslucencySnapshot nothing;
+    const auto previousSnapshot = std::exchange(m_snapshot, std::move(snapshot));
+    const ColorTranslucencySnapshot &previous = previousSnapshot ? *previousSnapshot : nothing;
+    const ColorTranslucencySnapshot &next = *m_snapshot;
+
+    const bool programsChanged = next.lookupTexture != previous.lookupTexture || next.specialize != previous.specialize;
+    // Saving in the KCM commits a preview through this reconfigure
+    const bool previewReplaced = std::exchange(m_previewActive, false) && m_shownTargets != next.colorSets.value(0);
+    m_previewPending = false;
+    m_previewWatcher.setWatchedServices({});
+    const bool colorsChanged = programsChanged || previewReplaced || next.colorSets != previous.colorSets;
+    const bool rulesChanged = next.inclusions != previous.inclusions || next.exclusions != previous.exclusions ||
+                              next.profileRules != previous.profileRules;
+    const bool probingChanged = next.contentProbing != previous.contentProbing ||
+                                next.tileOpaqueRegions != previous.tileOpaqueRegions;
+    const bool suspensionChanged = next.suspendHidden != previous.suspendHidden || next.evictionDelay != previous.evictionDelay;
+    const bool stateChanged = next.bypassFullscreen != previous.bypassFullscreen ||
+                              next.bypassMaximized != previous.bypassMaximized || suspensionChanged;
+
+    if (colorsChanged)
+        m_shaderManager.SetTargets(next.colorSets, next.lookupTexture, next.specialize);
+
+    m_contentProbing = next.contentProbing;
+    m_tileOpaqueRegions = next.tileOpaqueRegions;
+    m_evictionDelay = next.evictionDelay;
+    m_suspendHidden = next.suspendHidden;
+    m_bypassFullscreen = next.bypassFullscreen;
+    m_bypassMaximized = next.bypassMaximized;
+    // Also catches what changes without a repaint, like the end of a delay
+    if (m_evictionDelay > 0 || m_suspendHidden)
+        m_visibilityTimer.start(1000);
+    else
+        m_visibilityTimer.stop();
+    scheduleVisibilityUpdate();
+    m_probeInterval = next.probeInterval;
+    m_frameBudget = next.frameBudget;
+    for (auto &[screen, governor] : m_governors)
+        governor->SetBudget(m_frameBudget);
+    m_governorWindowLimit = next.governorWindowLimit;
 
-    m_activeColors = activeTargetColors();
-    m_activeAlphas = activeTargetAlphas();
-    qDebug() << "ColorTranslucencyEffect::reconfigure: config reloaded,";
-    qDebug() << "ColorTranslucencyEffect::reconfigure: m_activeColors: " << m_activeColors;
-    qDebug() << "ColorTranslucencyEffect::reconfigure: m_activeAlphas: " << m_activeAlphas;
+    // Only windows whose decision, colors or state inputs changed are touched
+    const auto setChanged = [&](int set) {
+        return set >= previous.colorSets.size() || set >= next.colorSets.size() ||
+               previous.colorSets[set] != next.colorSets[set] || (previewReplaced && set == 0);
+    };
+    m_shownTargets = next.colorSets.value(0);
+    int repainted = 0;
+    for (auto &[window, state] : m_managed)
+    {
+        auto *w = const_cast<KWin::EffectWindow *>(window);
+        const bool wasIncluded = state.included;
+        const bool wasKeyed = state.keyed;
+        const int previousProfile = state.profile;
+        if (rulesChanged && matchWindow(w, state))
+            Q_EMIT matchChanged(windowRecord(w, state));
+
+        // Probe results and masks are only valid for the targets they were taken with
+        const bool colors = programsChanged || state.profile != previousProfile || (colorsChanged && setChanged(state.profile));
+        if (colors || probingChanged)
+        {
+            state.probeEmpty = false;
+            state.probePending = true;
+            state.maskValid = false;
+            // A mask still in flight was drawn with the old targets
+            if (m_maskWindow == window)
+                m_maskWindow = nullptr;
+        }
+        if (!m_tileOpaqueRegions)
+            state.maskDamage = QRegion();
+        // Suspended again by the next visibility pass if that still applies
+        if (suspensionChanged)
+            state.suspended = 0;
+
+        if (!colors && !probingChanged && !stateChanged && state.included == wasIncluded)
+            continue;
+        updateWindowState(w, state);
+        if (wasKeyed || state.keyed)
+        {
+            w->addRepaintFull();
+            repainted++;
+        }
+    }
+
+    m_shaderManager.SetBinaryCache(next.shaderBinaryCache);
+    if (m_liveShaderReload != next.liveShaderReload)
+    {
+        m_liveShaderReload = next.liveShaderReload;
+        m_shaderManager.SetLiveShaderReload(m_liveShaderReload);
+        updateShaderWatcher();
+        m_shaderManager.ReloadSources();
+    }
+
+    // Profile names may have changed without their colors
+    updateDegradedProfiles();
+
+    qCDebug(COLORTRANSLUCENCY_LIFECYCLE) << "ColorTranslucencyEffect::applySnapshot: config reloaded, colors changed:" << colorsChanged
+             << "rules changed:" << rulesChanged << "windows repainted:" << repainted;
+    qCDebug(COLORTRANSLUCENCY_LIFECYCLE) << "ColorTranslucencyEffect::applySnapshot: active targets: " << next.targets.size();
+}
+
+void ColorTranslucencyEffect::applyPreview()
+{
+    m_previewPending = false;
+    if (m_snapshot->colorSets.isEmpty())
+        return;
+    const ColorTranslucencyTargets &targets = m_previewActive ? m_previewTargets : m_snapshot->colorSets[0];
+    if (targets == m_shownTargets)
+        return;
+
+    // Alpha edits key the same pixels, probe results and masks stay valid.
+    // Only the global targets are previewed, the profiles keep their sets.
+    const bool colorsMoved = !sameColors(targets, m_shownTargets);
+    m_shownTargets = targets;
+    m_shaderManager.SetProfileTargets(0, targets);
+    updateDegradedProfiles();
+
+    for (auto &[window, state] : m_managed)
+    {
+        if (!state.included || state.profile != 0)
+            continue;
+        auto *w = const_cast<KWin::EffectWindow *>(window);
+        if (colorsMoved)
+        {
+            state.probeEmpty = false;
+            state.probePending = true;
+            state.maskValid = false;
+            // A mask still in flight was drawn with the old targets
+            if (m_maskWindow == window)
+                m_maskWindow = nullptr;
+            updateWindowState(w, state);
+        }
+        if (state.keyed)
+            w->addRepaintFull();
+    }
+    qCDebug(COLORTRANSLUCENCY_LIFECYCLE) << "ColorTranslucencyEffect::applyPreview: showing" << m_shownTargets.size()
+                                         << "targets, preview:" << m_previewActive;
 }
 
 bool ColorTranslucencyEffect::isMaximized(const KWin::EffectWindow *w)
 {
-    auto screenGeometry = KWin::effects->findScreen(w->screen()->name())->geometry();
+    if (!w->screen())
+        return false;
+    const QRect screenGeometry = w->screen()->geometry();
     return (w->x() == screenGeometry.x() && w->width() == screenGeometry.width()) ||
            (w->y() == screenGeometry.y() && w->height() == screenGeometry.height());
 }
 
-QRectF operator*(QRect r, qreal scale) { return {r.x() * scale, r.y() * scale, r.width() * scale, r.height() * scale}; }
-QRectF operator*(QRectF r, qreal scale) { return {r.x() * scale, r.y() * scale, r.width() * scale, r.height() * scale}; }
-QRect toRect(const QRectF &r) { return {(int)r.x(), (int)r.y(), (int)r.width(), (int)r.height()}; }
-const QRect &toRect(const QRect &r) { return r; }
-
 void ColorTranslucencyEffect::prePaintWindow(KWin::EffectWindow *w, KWin::WindowPrePaintData &data, std::chrono::milliseconds time)
 {
-    if (!hasEffect(w))
+    const auto it = m_managed.find(w);
+    const ColorTranslucencyScopedTimer timer(m_clock, it != m_managed.end() && it->second.included ? &it->second.prePaintTime : nullptr,
+                                             m_frameStats);
+    ColorTranslucencyTraceSpan span("ColorTranslucencyEffect::prePaintWindow");
+    if (span.IsActive() && it != m_managed.end())
+        span.SetWindow(it->second.id, toRect(w->frameGeometry()));
+
+    // About to be drawn again, the offscreen texture has to come back first
+    if (it != m_managed.end() && (it->second.suspended & ~SuspendOccluded) && w->isPaintingEnabled())
+        resumeDrawn(w, it->second);
+    // Follows resizes, redirect() itself is not told about them
+    if (it != m_managed.end() && it->second.redirected)
+        updateOffscreenBytes(w, it->second);
+
+    if (it == m_managed.end() || !it->second.keyed)
     {
         Effect::prePaintWindow(w, data, time);
         return;
@@ -238,7 +895,22 @@ void ColorTranslucencyEffect::prePaintWindow(KWin::EffectWindow *w, KWin::Window
 #if KWIN_EFFECT_API_VERSION >= 234
     const auto geo_ex = w->expandedGeometry() * KWin::effects->renderTargetScale();
     const auto geo = w->frameGeometry() * KWin::effects->renderTargetScale();
+    const QRegion opaque = data.opaque;
     data.setTranslucent();
+
+    // Only the tiles showing a target color get translucent, everything else
+    // KWin considered opaque stays so and still hides the windows below.
+    // Content the mask has not seen yet, damaged or still being read back,
+    // may show a target color and stays translucent until then.
+    const auto &state = it->second;
+    const QRect expanded = toRect(w->expandedGeometry());
+    if (m_tileOpaqueRegions && state.maskValid && state.maskSize == expanded.size())
+    {
+        QRegion keyed;
+        for (const QRect &tile : (state.keyedTiles + state.maskDamage + state.maskPending).translated(expanded.topLeft()))
+            keyed += toRect(tile * KWin::effects->renderTargetScale());
+        data.opaque = opaque - keyed;
+    }
 #else
     const auto &geo_ex = w->expandedGeometry();
     const auto &geo = w->expandedGeometry();
@@ -253,7 +925,10 @@ void ColorTranslucencyEffect::prePaintWindow(KWin::EffectWindow *w, KWin::Window
 #if KWIN_EFFECT_API_VERSION >= 234
     data.opaque -= reg;
 #endif
-    data.paint += reg;
+    // The shadow ring only has to follow full repaints of the window, adding
+    // it to partial ones would make every blinking cursor cost the whole ring
+    if ((QRegion(toRect(geo)) - data.paint).isEmpty())
+        data.paint += reg;
 
 #if KWIN_EFFECT_API_VERSION >= 236
     OffscreenEffect::prePaintWindow(w, data, time);
@@ -262,6 +937,69 @@ void ColorTranslucencyEffect::prePaintWindow(KWin::EffectWindow *w, KWin::Window
 #endif
 }
 
+void ColorTranslucencyEffect::prePaintScreen(KWin::ScreenPrePaintData &data, std::chrono::milliseconds presentTime)
+{
+    if (!m_pendingWindows.isEmpty())
+        adoptPendingWindows();
+    if (m_previewPending)
+        applyPreview();
+
+    // Compiled right before the first frame that needs them
+    if (!m_shaderManager.IsInitialized() &&
+        std::any_of(m_managed.begin(), m_managed.end(), [](const auto &entry) { return entry.second.keyed; }))
+        initializeShaders();
+
+    // Programs built in the background replace the current ones between frames
+    if (m_shaderManager.Update())
+    {
+        KWin::effects->addRepaintFull();
+        updateDegradedProfiles();
+    }
+
+    // Which windows are topmost changes with the stacking order
+    if (std::any_of(m_governors.begin(), m_governors.end(), [](const auto &entry) {
+            return entry.second->GetLevel() >= ColorTranslucencyGovernor::LevelLimited;
+        }))
+        updateThrottling();
+
+    KWin::effects->prePaintScreen(data, presentTime);
+}
+
+void ColorTranslucencyEffect::postPaintScreen()
+{
+    if (m_contentProbing)
+        readProbes();
+    if (m_tileMask.IsBusy())
+        readTileMask();
+    m_texturePool.Trim(std::max(m_evictionDelay, 1000));
+
+    m_frameStats.EndFrame(m_keyedDraws);
+    m_keyedDraws = 0;
+    if (m_governor->EndFrame())
+    {
+        updateThrottling();
+        KWin::effects->addRepaintFull();
+    }
+
+    // Keep frames coming so that finished builds get polled
+    if (m_shaderManager.HasPendingBuilds())
+        KWin::effects->addRepaintFull();
+
+    KWin::effects->postPaintScreen();
+}
+
+void ColorTranslucencyEffect::paintScreen(int mask, const QRegion &region, KWin::ScreenPaintData &data)
+{
+#if KWIN_EFFECT_API_VERSION >= 234
+    m_governor = &governorFor(data.screen());
+#endif
+    if (m_shaderManager.IsInitialized())
+        m_governor->Initialize();
+    m_governor->BeginFrame();
+    KWin::effects->paintScreen(mask, region, data);
+    m_shaderManager.EndFrame();
+}
+
 bool ColorTranslucencyEffect::supported()
 {
     return KWin::effects->isOpenGLCompositing();
@@ -270,19 +1008,69 @@ bool ColorTranslucencyEffect::supported()
 void ColorTranslucencyEffect::drawWindow(KWin::EffectWindow *w, int mask, const QRegion &region,
                                          KWin::WindowPaintData &data)
 {
-    if (!hasEffect(w))
+    const auto it = m_managed.find(w);
+    const bool counted = it != m_managed.end() && it->second.included;
+    const ColorTranslucencyScopedTimer timer(m_clock, counted ? &it->second.drawTime : nullptr, m_frameStats);
+    if (counted)
+        it->second.framesDrawn++;
+    ColorTranslucencyTraceSpan span("ColorTranslucencyEffect::drawWindow");
+    if (span.IsActive() && it != m_managed.end())
+        span.SetWindow(it->second.id, toRect(w->frameGeometry()));
+    if (it != m_managed.end())
     {
-        unredirect(w);
+        it->second.lastDrawn = m_clock.elapsed();
+        // Painting enabled by an effect after our prePaintWindow, key it from the next frame on
+        if (it->second.suspended & ~SuspendOccluded)
+        {
+            resumeDrawn(w, it->second);
+            w->addRepaintFull();
+        }
+    }
+
+    if (it == m_managed.end() || !it->second.keyed)
+    {
+        if (it != m_managed.end() && it->second.probeEmpty)
+            it->second.probeSkippedFrames++;
+
 #if KWIN_EFFECT_API_VERSION >= 236
         OffscreenEffect::drawWindow(w, mask, region, data);
 #else
         DeformEffect::drawWindow(w, mask, region, data);
 #endif
+        if (it != m_managed.end() && it->second.probeEmpty && it->second.included && isProbeDue(it->second) &&
+            m_governor->GetLevel() == ColorTranslucencyGovernor::LevelFull)
+            drawCapturedProbe(w, it->second, mask, data);
         return;
     }
-    redirect(w);
-    setShader(w, m_shaderManager.GetShader().get());
-    m_shaderManager.Bind(w);
+
+    auto &state = it->second;
+    updatePaintScale(state, data);
+    qCTrace() << "ColorTranslucencyEffect::drawWindow:" << state.title << "profile" << state.profile
+              << "scale" << state.paintScale << "region" << region.boundingRect();
+    m_governor->BeginDraw(w);
+    m_keyedDraws++;
+
+    // Thumbnails change size every frame of an animation, content changes are
+    // probed once the window is back at full size unless it was never probed
+    const bool extraPasses = m_governor->GetLevel() == ColorTranslucencyGovernor::LevelFull;
+    if (extraPasses && isProbeDue(state) && (!state.scaledDown || !state.probes))
+        drawProbe(w, state, mask, data);
+
+    drawKeyed(w, mask, region, data, m_shaderManager.Bind(state.profile));
+
+    // Drawn after the window so the offscreen texture is already up to date.
+    // Transformed draws (animations, overview) would not match the geometry.
+    if (m_tileOpaqueRegions && extraPasses && !state.scaledDown && (!state.maskValid || !state.maskDamage.isEmpty()) && !m_tileMask.IsBusy() &&
+        data.xScale() == 1.0 && data.yScale() == 1.0 && data.xTranslation() == 0.0 && data.yTranslation() == 0.0)
+        drawTileMask(w, state, mask, data);
+
+    m_governor->EndDraw();
+}
+
+void ColorTranslucencyEffect::drawKeyed(KWin::EffectWindow *w, int mask, const QRegion &region,
+                                        KWin::WindowPaintData &data, KWin::GLShader *shader)
+{
+    setShader(w, shader);
     glActiveTexture(GL_TEXTURE0);
 
 #if KWIN_EFFECT_API_VERSION >= 236
@@ -290,7 +1078,153 @@ void ColorTranslucencyEffect::drawWindow(KWin::EffectWindow *w, int mask, const
 #else
     DeformEffect::drawWindow(w, mask, region, data);
 #endif
-    m_shaderManager.Unbind();
+    // Nothing else may draw with the shader or the lookup tables bound
+    m_shaderManager.Release();
+}
+
+void ColorTranslucencyEffect::updatePaintScale(ColorTranslucencyWindow &state, const KWin::WindowPaintData &data)
+{
+    state.paintScale = std::clamp(std::min(data.xScale(), data.yScale()), 0.01, 1.0);
+    if (state.scaledDown ? state.paintScale > SCALED_DOWN_LEAVE : state.paintScale < SCALED_DOWN_ENTER)
+        state.scaledDown = !state.scaledDown;
+    if (state.scaledDown)
+        state.scaledFrames++;
+}
+
+bool ColorTranslucencyEffect::isProbeDue(const ColorTranslucencyWindow &state) const
+{
+    return m_contentProbing && state.probePending && !state.probeQuery && m_clock.elapsed() - state.lastProbe >= m_probeInterval;
+}
+
+void ColorTranslucencyEffect::drawProbe(KWin::EffectWindow *w, ColorTranslucencyWindow &state, int mask,
+                                        const KWin::WindowPaintData &data)
+{
+    auto shader = m_shaderManager.BindProbe(state.profile);
+    if (!shader)
+        return;
+
+#if KWIN_EFFECT_API_VERSION >= 234
+    const qreal deviceScale = KWin::effects->renderTargetScale();
+#else
+    const qreal deviceScale = 1.0;
+#endif
+    const QRect expanded = toRect(w->expandedGeometry());
+    QMatrix4x4 projection;
+    if (!m_probe.BeginTarget(expanded.size(), deviceScale, projection))
+    {
+        m_shaderManager.Release();
+        return;
+    }
+
+    // The offscreen texture is rendered once for both draws, so this only costs
+    // a quad at the window's size, whatever size it is shown at. Nothing is
+    // written, color writes are off.
+    KWin::WindowPaintData probeData(data);
+    probeData.setXScale(1.0);
+    probeData.setYScale(1.0);
+    probeData.setXTranslation(-expanded.x());
+    probeData.setYTranslation(-expanded.y());
+    probeData.setProjectionMatrix(projection);
+
+    state.probeQuery = m_probe.Begin();
+    drawKeyed(w, mask, KWin::infiniteRegion(), probeData, shader);
+    m_probe.End();
+    m_probe.EndTarget();
+
+    state.probePending = false;
+    state.lastProbe = m_clock.elapsed();
+    state.probes++;
+}
+
+void ColorTranslucencyEffect::drawCapturedProbe(KWin::EffectWindow *w, ColorTranslucencyWindow &state, int mask,
+                                                const KWin::WindowPaintData &data)
+{
+    if (!m_shaderManager.IsValid())
+        return;
+
+#if KWIN_EFFECT_API_VERSION >= 234
+    const qreal deviceScale = KWin::effects->renderTargetScale();
+#else
+    const qreal deviceScale = 1.0;
+#endif
+    const QRect expanded = toRect(w->expandedGeometry());
+    QMatrix4x4 projection;
+    if (!m_probe.BeginTarget(expanded.size(), deviceScale, projection))
+        return;
+
+    // KWin draws the window once more, untransformed and fully opaque, into
+    // the target. It stays unredirected, no offscreen texture is allocated.
+    KWin::WindowPaintData captureData(data);
+    captureData.setXScale(1.0);
+    captureData.setYScale(1.0);
+    captureData.setXTranslation(-expanded.x());
+    captureData.setYTranslation(-expanded.y());
+    captureData.setOpacity(1.0);
+    captureData.setBrightness(1.0);
+    captureData.setSaturation(1.0);
+    captureData.setProjectionMatrix(projection);
+    KWin::effects->drawWindow(w, mask | PAINT_WINDOW_TRANSFORMED, KWin::infiniteRegion(), captureData);
+
+    auto shader = m_shaderManager.BindProbe(state.profile);
+    m_probe.EndTarget(shader != nullptr);
+    if (!shader)
+        return;
+    state.probeQuery = m_probe.CountTarget(shader);
+    m_shaderManager.Release();
+
+    state.probePending = false;
+    state.lastProbe = m_clock.elapsed();
+    state.probes++;
+}
+
+void ColorTranslucencyEffect::drawTileMask(KWin::EffectWindow *w, ColorTranslucencyWindow &state, int mask,
+                                           const KWin::WindowPaintData &data)
+{
+    if (!ColorTranslucencyTileMask::IsSupported())
+        return;
+    auto shader = m_shaderManager.BindProbe(state.profile);
+    if (!shader)
+        return;
+
+#if KWIN_EFFECT_API_VERSION >= 234
+    const qreal deviceScale = KWin::effects->renderTargetScale();
+#else
+    const qreal deviceScale = 1.0;
+#endif
+    const QRect expanded = toRect(w->expandedGeometry());
+
+    // A resize or a missing mask redraws all tiles, otherwise only the damaged ones
+    const int size = ColorTranslucencyTileMask::TILE_SIZE;
+    const QRect allTiles(0, 0, (expanded.width() + size - 1) / size, (expanded.height() + size - 1) / size);
+    QRect dirtyTiles = allTiles;
+    if (state.maskValid && state.maskSize == expanded.size())
+    {
+        const QRect damage = state.maskDamage.boundingRect();
+        dirtyTiles = QRect(QPoint(damage.left() / size, damage.top() / size),
+                           QPoint(damage.right() / size, damage.bottom() / size)) & allTiles;
+    }
+    else
+        state.keyedTiles = QRegion();
+
+    QMatrix4x4 projection;
+    if (!m_tileMask.Begin(expanded.size(), dirtyTiles, deviceScale, projection))
+    {
+        m_shaderManager.Release();
+        return;
+    }
+
+    // Moved so that the expanded geometry starts at the mask origin
+    KWin::WindowPaintData maskData(data);
+    maskData.setXTranslation(-expanded.x());
+    maskData.setYTranslation(-expanded.y());
+    maskData.setProjectionMatrix(projection);
+    drawKeyed(w, mask, KWin::infiniteRegion(), maskData, shader);
+    m_tileMask.End();
+
+    m_maskWindow = w;
+    state.maskPending = QRect(dirtyTiles.topLeft() * size, dirtyTiles.size() * size);
+    state.maskDamage = QRegion();
+    state.maskSize = expanded.size();
 }
 
 QString ColorTranslucencyEffect::get_window_title(const KWin::EffectWindow *w) const
@@ -311,49 +1245,330 @@ QString ColorTranslucencyEffect::get_window_title(const KWin::EffectWindow *w) c
     return windowTitle;
 }
 
-bool ColorTranslucencyEffect::hasEffect(const KWin::EffectWindow *w) const
+QVariantMap ColorTranslucencyEffect::windowRecord(const KWin::EffectWindow *w, const ColorTranslucencyWindow &state) const
 {
+    return {
+        {QStringLiteral("id"), state.id},
+        {QStringLiteral("class"), state.title},
+        {QStringLiteral("windowClass"), state.windowClass},
+        {QStringLiteral("caption"), w->caption()},
+        {QStringLiteral("role"), w->windowRole()},
+        // Panels, the desktop, popups and notifications, the KCM does not offer them
+        {QStringLiteral("special"), w->isSpecialWindow() || w->isPopupWindow() || w->isNotification()},
+        {QStringLiteral("included"), state.included},
+        {QStringLiteral("rule"), m_snapshot->rules.GetRuleText(state.rule)},
+        {QStringLiteral("profile"), state.profile > 0 ? m_snapshot->profiles[state.profile - 1].name : QString()},
+        {QStringLiteral("keyed"), state.keyed},
+    };
+}
 
-    if (!m_shaderManager.IsValid())
+QVariantList ColorTranslucencyEffect::get_windows()
+{
+    QVariantList response;
+    response.reserve(int(m_managed.size()));
+    for (const auto &[win, state] : m_managed)
+        response.push_back(windowRecord(win, state));
+    qCDebug(COLORTRANSLUCENCY) << "ColorTranslucencyEffect::get_windows: found" << response.size() << "windows";
+    return response;
+}
+
+QVariantMap ColorTranslucencyEffect::get_shader_counters()
+{
+    const auto &lastFrame = m_shaderManager.GetLastFrameCounters();
+    const auto &total = m_shaderManager.GetTotalCounters();
+    return {
+        {QStringLiteral("lastFrameBinds"), lastFrame.binds},
+        {QStringLiteral("lastFrameUploads"), lastFrame.uploads},
+        {QStringLiteral("lastFrameGlCalls"), lastFrame.glCalls},
+        {QStringLiteral("totalBinds"), total.binds},
+        {QStringLiteral("totalUploads"), total.uploads},
+        {QStringLiteral("totalGlCalls"), total.glCalls},
+        {QStringLiteral("startupMs"), m_shaderManager.GetStartupTime()},
+        {QStringLiteral("binaryCacheHits"), m_shaderManager.GetCache().GetHits()},
+        {QStringLiteral("binaryCacheMisses"), m_shaderManager.GetCache().GetMisses()},
+        {QStringLiteral("probeUnredirects"), m_probeUnredirects},
+        {QStringLiteral("uniformSets"), m_shaderManager.GetProfileCount()},
+        {QStringLiteral("degradedProfiles"), m_degradedProfiles},
+    };
+}
+
+void ColorTranslucencyEffect::updateDegradedProfiles()
+{
+    // Only known for sure once the lookup texture shader is built or failed
+    QStringList profiles;
+    for (int profile = 0; profile < m_shaderManager.GetProfileCount(); profile++)
     {
-        return false;
+        if (m_shaderManager.GetDroppedColors(profile) == 0)
+            continue;
+        profiles.push_back(profile > 0 && profile <= int(m_snapshot->profiles.size()) ? m_snapshot->profiles[profile - 1].name : QString());
     }
 
-    QStringList inclusions = ColorTranslucencyConfig::inclusionList();
-    QStringList exclusions = ColorTranslucencyConfig::exclusionList();
+    if (profiles == m_degradedProfiles)
+        return;
+    m_degradedProfiles = profiles;
+    Q_EMIT degradedProfilesChanged(m_degradedProfiles);
+}
 
-    QString windowTitle = get_window_title(w);
-    if (!m_managed.contains(w))
+QVariantMap ColorTranslucencyEffect::get_memory_usage()
+{
+    QVariantMap windows;
+    for (const auto &[win, state] : m_managed)
     {
-        return false;
+        if (!state.included)
+            continue;
+
+        windows.insert(state.title, QVariantMap{
+            {QStringLiteral("estimatedBytes"), state.offscreenBytes},
+            {QStringLiteral("peakEstimatedBytes"), state.peakOffscreenBytes},
+            {QStringLiteral("suspended"), state.suspended != 0},
+        });
     }
 
-    if (inclusions.contains(windowTitle, Qt::CaseInsensitive))
+    // KWin allocates the offscreen textures, their size is only estimated.
+    // The pool holds the probe and tile mask targets and is exact.
+    return {
+        {QStringLiteral("estimatedOffscreenBytes"), m_offscreenBytes},
+        {QStringLiteral("peakEstimatedOffscreenBytes"), m_peakOffscreenBytes},
+        {QStringLiteral("evictions"), m_evictions},
+        {QStringLiteral("poolBytes"), m_texturePool.GetBytes()},
+        {QStringLiteral("peakPoolBytes"), m_texturePool.GetPeakBytes()},
+        {QStringLiteral("poolTextures"), m_texturePool.GetCount()},
+        {QStringLiteral("windows"), windows},
+    };
+}
+
+QVariantMap ColorTranslucencyEffect::get_suspension_stats()
+{
+    QVariantMap byReason;
+    QVariantMap current;
+    for (size_t bit = 0; bit < m_suspendsByReason.size(); bit++)
     {
-        return true;
+        const QString name = QString::fromLatin1(SUSPEND_REASON_NAMES[bit]);
+        byReason.insert(name, m_suspendsByReason[bit]);
+        current.insert(name, int(std::count_if(m_managed.begin(), m_managed.end(),
+                                               [bit](const auto &entry) { return entry.second.suspended & (1 << bit); })));
     }
 
-    if (exclusions.contains(windowTitle, Qt::CaseInsensitive))
+    return {
+        {QStringLiteral("suspends"), m_suspends},
+        {QStringLiteral("resumes"), m_resumes},
+        {QStringLiteral("suspendsByReason"), byReason},
+        {QStringLiteral("suspendedNow"), current},
+        {QStringLiteral("bypassed"), int(std::count_if(m_managed.begin(), m_managed.end(),
+                                                       [](const auto &entry) { return entry.second.bypassed; }))},
+    };
+}
+
+QVariantMap ColorTranslucencyEffect::get_rule_matches()
+{
+    QVariantMap windows;
+    for (const auto &[win, state] : m_managed)
     {
-        return false;
+        if (state.rule < 0 && !state.profile)
+            continue;
+        windows.insert(state.title, QVariantMap{
+            {QStringLiteral("included"), state.included},
+            {QStringLiteral("rule"), m_snapshot->rules.GetRuleText(state.rule)},
+            {QStringLiteral("profile"), state.profile ? m_snapshot->profiles[state.profile - 1].name : QString()},
+        });
     }
-    return false;
+
+    return {
+        {QStringLiteral("rules"), m_snapshot->rules.GetRuleCount()},
+        {QStringLiteral("rejected"), m_snapshot->rules.GetRejectedCount()},
+        {QStringLiteral("profiles"), int(m_snapshot->profiles.size())},
+        {QStringLiteral("windows"), windows},
+    };
 }
 
-QString ColorTranslucencyEffect::get_window_titles()
+QVariantMap ColorTranslucencyEffect::get_governor_state()
 {
-    QSet<QString> response;
-    for (const auto &win : m_managed)
+    // The top level reports the most stepped down output
+    QVariantMap screens;
+    auto level = ColorTranslucencyGovernor::LevelFull;
+    quint64 stepDowns = 0;
+    quint64 stepUps = 0;
+    for (const auto &[screen, governor] : m_governors)
     {
-        QString windowTitle = get_window_title(win);
+        // Only stands in for the outputs until they paint themselves
+        if (!screen && m_governors.size() > 1)
+            continue;
+        screens.insert(screen ? screen->name() : QStringLiteral("all"), QVariantMap{
+            {QStringLiteral("level"), QString::fromLatin1(ColorTranslucencyGovernor::LevelName(governor->GetLevel()))},
+            {QStringLiteral("cpuTime"), governor->GetCpuTime()},
+            {QStringLiteral("gpuTime"), governor->GetGpuTime()},
+            {QStringLiteral("stepDowns"), governor->GetStepDowns()},
+            {QStringLiteral("stepUps"), governor->GetStepUps()},
+        });
+        level = std::max(level, governor->GetLevel());
+        stepDowns += governor->GetStepDowns();
+        stepUps += governor->GetStepUps();
+    }
 
-        if (windowTitle.contains("plasmashell", Qt::CaseInsensitive))
+    return {
+        {QStringLiteral("level"), QString::fromLatin1(ColorTranslucencyGovernor::LevelName(level))},
+        {QStringLiteral("forcedLevel"), m_forcedLevel},
+        {QStringLiteral("budget"), m_frameBudget},
+        {QStringLiteral("gpuTimer"), m_governor->HasGpuTimer()},
+        {QStringLiteral("windowLimit"), m_governorWindowLimit},
+        {QStringLiteral("stepDowns"), stepDowns},
+        {QStringLiteral("stepUps"), stepUps},
+        {QStringLiteral("screens"), screens},
+        {QStringLiteral("throttled"), int(std::count_if(m_managed.begin(), m_managed.end(),
+                                                        [](const auto &entry) { return entry.second.throttled; }))},
+    };
+}
+
+QVariantMap ColorTranslucencyEffect::get_performance_stats()
+{
+    QVariantMap windows;
+    for (const auto &[win, state] : m_managed)
+    {
+        if (!state.included)
             continue;
 
-        response.insert(windowTitle);
+        windows.insert(state.title, QVariantMap{
+            {QStringLiteral("framesDrawn"), state.framesDrawn},
+            {QStringLiteral("prePaintUs"), state.prePaintTime / 1000},
+            {QStringLiteral("drawUs"), state.drawTime / 1000},
+            {QStringLiteral("gpuUs"), state.gpuTime / 1000},
+            {QStringLiteral("estimatedOffscreenBytes"), state.offscreenBytes},
+            {QStringLiteral("redirects"), state.redirects},
+            {QStringLiteral("unredirects"), state.unredirects},
+        });
     }
-    qDebug() << "ColorTranslucencyEffect::get_window_titles: found" << response.size() << " window titles,";
-    qDebug() << "ColorTranslucencyEffect::get_window_titles: window titles:" << response.values().join("\n");
 
-    return response.values().join("\n");
+    QVariantMap response = m_frameStats.ToVariant();
+    response.insert(QStringLiteral("gpuTimer"), m_governor->HasGpuTimer());
+    response.insert(QStringLiteral("windows"), windows);
+    return response;
+}
+
+void ColorTranslucencyEffect::reset_performance_stats()
+{
+    m_frameStats.Reset();
+    for (auto &[win, state] : m_managed)
+    {
+        state.framesDrawn = 0;
+        state.prePaintTime = 0;
+        state.drawTime = 0;
+        state.gpuTime = 0;
+        state.redirects = 0;
+        state.unredirects = 0;
+    }
+}
+
+void ColorTranslucencyEffect::preview_targets(const QStringList &targets)
+{
+    ColorTranslucencyTargets parsed;
+    for (const auto &entry : targets)
+    {
+        ColorTranslucencyTarget target;
+        if (ColorTranslucencySnapshot::ParseTarget(entry, target))
+            parsed.push_back(target);
+        else
+            qCWarning(COLORTRANSLUCENCY) << "ColorTranslucencyEffect::preview_targets: ignoring malformed target" << entry;
+    }
+
+    m_previewTargets = std::move(parsed);
+    m_previewActive = true;
+    if (calledFromDBus())
+        m_previewWatcher.setWatchedServices({message().service()});
+    // Applied by the next prePaintScreen, whatever else arrives until then
+    if (!std::exchange(m_previewPending, true))
+        KWin::effects->addRepaintFull();
+}
+
+void ColorTranslucencyEffect::end_preview()
+{
+    if (!m_previewActive)
+        return;
+
+    m_previewActive = false;
+    m_previewWatcher.setWatchedServices({});
+    if (!std::exchange(m_previewPending, true))
+        KWin::effects->addRepaintFull();
+}
+
+void ColorTranslucencyEffect::set_tracing(bool enabled)
+{
+    ColorTranslucencyTrace &trace = ColorTranslucencyTrace::Global();
+    if (!enabled)
+    {
+        trace.Stop();
+        return;
+    }
+
+    trace.Start();
+    // Windows matched before the recording started
+    for (const auto &[win, state] : m_managed)
+        trace.NameWindow(state.id, state.windowClass);
+}
+
+QString ColorTranslucencyEffect::dump_trace(const QString &name)
+{
+    // The compositor writes wherever it is told otherwise, keep callers to its own directory
+    if (name.contains(QLatin1Char('/')) || name == QLatin1String(".") || name == QLatin1String(".."))
+    {
+        if (calledFromDBus())
+            sendErrorReply(QDBusError::InvalidArgs, QStringLiteral("Expected a file name, not a path"));
+        return QString();
+    }
+
+    const QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/colortranslucency");
+    const QString target = directory + QLatin1Char('/') + (!name.isEmpty() ? name :
+        QStringLiteral("trace-%1.json").arg(QDateTime::currentDateTime().toString(QStringLiteral("yyyyMMdd-hhmmss"))));
+
+    // Serializing a full ring takes longer than a frame, answer once it is written
+    QDBusMessage reply;
+    if (calledFromDBus())
+    {
+        setDelayedReply(true);
+        reply = message().createReply();
+    }
+    m_configLoader.start([directory, target, reply]() mutable {
+        const bool written = QDir().mkpath(directory) && ColorTranslucencyTrace::Global().Write(target);
+        if (reply.type() == QDBusMessage::InvalidMessage)
+            return;
+        reply << (written ? target : QString());
+        QDBusConnection::sessionBus().send(reply);
+    });
+    return target;
+}
+
+void ColorTranslucencyEffect::set_frame_budget(int budget)
+{
+    // Not saved, the next reconfigure goes back to FrameTimeBudget
+    m_frameBudget = budget;
+    for (auto &[screen, governor] : m_governors)
+        governor->SetBudget(budget);
+    KWin::effects->addRepaintFull();
+}
+
+void ColorTranslucencyEffect::set_governor_level(int level)
+{
+    m_forcedLevel = level >= 0 && level < ColorTranslucencyGovernor::LEVEL_COUNT ? level : -1;
+    for (auto &[screen, governor] : m_governors)
+        governor->SetForcedLevel(level);
+    KWin::effects->addRepaintFull();
+}
+
+QVariantMap ColorTranslucencyEffect::get_probe_results()
+{
+    QVariantMap response;
+    for (const auto &[win, state] : m_managed)
+    {
+        if (!state.included)
+            continue;
+
+        response.insert(state.title, QVariantMap{
+            {QStringLiteral("matches"), state.probeMatches},
+            {QStringLiteral("empty"), state.probeEmpty},
+            {QStringLiteral("probes"), state.probes},
+            {QStringLiteral("skippedFrames"), state.probeSkippedFrames},
+            {QStringLiteral("paintScale"), state.paintScale},
+            {QStringLiteral("scaledFrames"), state.scaledFrames},
+        });
+    }
+    return response;
 }
@@ -20,15 +20,36 @@
 #pragma once
 
 #include <kwineffects.h>
-#include <set>
+#include <array>
+#include <map>
+#include <memory>
+#include <QDBusContext>
+#include <QDBusServiceWatcher>
+#include <QElapsedTimer>
+#include <QFileSystemWatcher>
+#include <QPointer>
+#include <QQueue>
+#include <QThreadPool>
+#include <QSet>
+#include <QTimer>
+#include <unordered_map>
+#include <vector>
+#include "ColorTranslucencyGovernor.h"
+#include "ColorTranslucencyProbe.h"
 #include "ColorTranslucencyShader.h"
+#include "ColorTranslucencySnapshot.h"
+#include "ColorTranslucencyStats.h"
+#include "ColorTranslucencyTexturePool.h"
+#include "ColorTranslucencyTileMask.h"
+#include "ColorTranslucencyTrace.h"
+#include "ColorTranslucencyWindow.h"
 
 #if KWIN_EFFECT_API_VERSION >= 236
 #include <kwinoffscreeneffect.h>
-class ColorTranslucencyEffect : public KWin::OffscreenEffect
+class ColorTranslucencyEffect : public KWin::OffscreenEffect, protected QDBusContext
 #else
 #include <kwindeformeffect.h>
-class ColorTranslucencyEffect : public KWin::DeformEffect
+class ColorTranslucencyEffect : public KWin::DeformEffect, protected QDBusContext
 #endif
 {
     Q_OBJECT
@@ -39,32 +60,171 @@ public:
     static bool supported();
     static bool enabledByDefault() { return supported(); }
     static bool isMaximized(const KWin::EffectWindow *w);
-    static bool isWindowActive(const KWin::EffectWindow *w) { return KWin::effects->activeWindow() == w; }
 
     void reconfigure(ReconfigureFlags flags) override;
 
+    void prePaintScreen(KWin::ScreenPrePaintData &data, std::chrono::milliseconds presentTime) override;
+    void paintScreen(int mask, const QRegion &region, KWin::ScreenPaintData &data) override;
+    void postPaintScreen() override;
     void prePaintWindow(KWin::EffectWindow *w, KWin::WindowPrePaintData &data, std::chrono::milliseconds time) override;
     void drawWindow(KWin::EffectWindow *window, int mask, const QRegion &region, KWin::WindowPaintData &data) override;
 
     int requestedEffectChainPosition() const override { return 99; }
 
 public Q_SLOTS:
-    QString get_window_titles();
+    // One record per window, see windowRecord()
+    QVariantList get_windows();
+    QVariantMap get_shader_counters();
+    QVariantMap get_probe_results();
+    QVariantMap get_memory_usage();
+    QVariantMap get_suspension_stats();
+    QVariantMap get_rule_matches();
+    QVariantMap get_governor_state();
+    QVariantMap get_performance_stats();
+    void reset_performance_stats();
+    // Shows `targets` ("#rrggbb alpha [tolerance]" each) instead of the
+    // configured global targets until end_preview() or the next reconfigure
+    void preview_targets(const QStringList &targets);
+    void end_preview();
+    void set_tracing(bool enabled);
+    // Writes the recorded spans to `name` (a file name, not a path) in the
+    // cache directory off the compositor thread, replies with the path written
+    QString dump_trace(const QString &name);
+    void set_frame_budget(int budget);
+    void set_governor_level(int level);
+
+Q_SIGNALS:
+    // Incremental updates to get_windows(), exported over D-Bus
+    void windowAdded(const QVariantMap &window);
+    void windowRemoved(uint id);
+    // The class, inclusion, deciding rule or profile of a window changed
+    void matchChanged(const QVariantMap &window);
+    // Profiles that lose colors beyond the tenth, see get_shader_counters()
+    void degradedProfilesChanged(const QStringList &profiles);
 
 protected Q_SLOTS:
-    void windowAdded(KWin::EffectWindow *window);
-    void windowRemoved(KWin::EffectWindow *window);
+    void slotWindowAdded(KWin::EffectWindow *window);
+    void slotWindowRemoved(KWin::EffectWindow *window);
+    void slotWindowDamaged(KWin::EffectWindow *window, const QRegion &region);
+    void slotScreenRemoved(KWin::EffectScreen *screen);
+    void slotWindowMatchChanged();
 
 public:
     QString get_window_title(const KWin::EffectWindow *w) const;
-    static QVector<QColor> getActiveColors();
-    static QVector<int> getActiveAlphas();
 
 private:
-    std::set<const KWin::EffectWindow *> m_managed;
+    std::unordered_map<const KWin::EffectWindow *, ColorTranslucencyWindow> m_managed;
+    // Managed windows by the object that signals their class and caption changes
+    std::unordered_map<const QObject *, KWin::EffectWindow *> m_matchSources;
     ColorTranslucencyShader m_shaderManager;
-    static QVector<QColor> m_activeColors;
-    static QVector<int> m_activeAlphas;
 
-    bool hasEffect(const KWin::EffectWindow *w) const;
+    // Configuration in use. A reconfigure parses the next one on m_configLoader
+    // and queues it to the compositor thread, which swaps it in between frames.
+    std::shared_ptr<const ColorTranslucencySnapshot> m_snapshot;
+    QThreadPool m_configLoader;
+    bool m_loading = false;
+    bool m_loadAgain = false;
+    // Windows that existed before the effect was loaded, adopted a few per frame
+    QQueue<QPointer<KWin::EffectWindow>> m_pendingWindows;
+    // Installed shader sources, only watched with LiveShaderReload on
+    QFileSystemWatcher m_shaderWatcher;
+    bool m_liveShaderReload = false;
+
+    // Render targets of the probes and tile masks
+    ColorTranslucencyTexturePool m_texturePool;
+
+    // Skips the color key for windows that show none of the target colors
+    ColorTranslucencyProbe m_probe{m_texturePool};
+    QElapsedTimer m_clock;
+    QTimer m_probeTimer;
+    bool m_contentProbing = false;
+    int m_probeInterval = 500;
+    quint64 m_probeUnredirects = 0;
+
+    // Feeds the parts of keyed windows without target colors back to KWin as opaque
+    ColorTranslucencyTileMask m_tileMask{m_texturePool};
+    const KWin::EffectWindow *m_maskWindow = nullptr;
+    bool m_tileOpaqueRegions = true;
+
+    quint64 m_offscreenBytes = 0;
+    quint64 m_peakOffscreenBytes = 0;
+
+    // Windows that will not be painted give their offscreen texture back
+    QTimer m_visibilityTimer;
+    // Runs a pass right after a window was hidden, uncovered or moved
+    QTimer m_visibilityUpdate;
+    bool m_suspendHidden = true;
+    int m_evictionDelay = 30000;
+    quint64 m_suspends = 0;
+    quint64 m_resumes = 0;
+    // Suspensions that unredirected a window, freeing its offscreen texture
+    quint64 m_evictions = 0;
+    // Suspensions per ColorTranslucencySuspendReason bit
+    std::array<quint64, 5> m_suspendsByReason{};
+
+    // Fullscreen games and videos skip the effect so they can be scanned out
+    bool m_bypassFullscreen = false;
+    bool m_bypassMaximized = false;
+
+    // Step the effect down while it costs more per frame than the budget. Every
+    // output paints its own frames, so each one gets a governor; nullptr stands
+    // for all of them where KWin does not paint per output.
+    std::map<const KWin::EffectScreen *, std::unique_ptr<ColorTranslucencyGovernor>> m_governors;
+    // Governor of the output being painted
+    ColorTranslucencyGovernor *m_governor = nullptr;
+    qint64 m_frameBudget = 0;
+    int m_forcedLevel = -1;
+    int m_governorWindowLimit = 3;
+
+    // Global targets previewed by the KCM. Edits arriving between two frames
+    // collapse into one update, KConfig is never touched.
+    ColorTranslucencyTargets m_previewTargets;
+    bool m_previewActive = false;
+    bool m_previewPending = false;
+    // Global targets currently handed to the shader manager
+    ColorTranslucencyTargets m_shownTargets;
+    // Names of the profiles drawn with only their first colors, the global
+    // targets as an empty name
+    QStringList m_degradedProfiles;
+    // Ends the preview when the KCM goes away without ending it
+    QDBusServiceWatcher m_previewWatcher;
+
+    // Always on, a few clock reads per window and frame
+    ColorTranslucencyFrameStats m_frameStats;
+    int m_keyedDraws = 0;
+
+    void loadSnapshot();
+    void snapshotLoaded(std::shared_ptr<const ColorTranslucencySnapshot> snapshot);
+    void applySnapshot(std::shared_ptr<const ColorTranslucencySnapshot> snapshot);
+    void applyPreview();
+    void updateWindowState(KWin::EffectWindow *w, ColorTranslucencyWindow &state);
+    // Returns true when the record of the window changed
+    bool matchWindow(KWin::EffectWindow *w, ColorTranslucencyWindow &state);
+    void watchMatch(KWin::EffectWindow *w, ColorTranslucencyWindow &state);
+    void rematchWindow(KWin::EffectWindow *w, ColorTranslucencyWindow &state);
+    QVariantMap windowRecord(const KWin::EffectWindow *w, const ColorTranslucencyWindow &state) const;
+    void registerDBus();
+    void adoptPendingWindows();
+    void initializeShaders();
+    void updateShaderWatcher();
+    void shaderFilesChanged();
+    void drawKeyed(KWin::EffectWindow *w, int mask, const QRegion &region, KWin::WindowPaintData &data, KWin::GLShader *shader);
+    void updatePaintScale(ColorTranslucencyWindow &state, const KWin::WindowPaintData &data);
+    bool isProbeDue(const ColorTranslucencyWindow &state) const;
+    void drawProbe(KWin::EffectWindow *w, ColorTranslucencyWindow &state, int mask, const KWin::WindowPaintData &data);
+    void drawCapturedProbe(KWin::EffectWindow *w, ColorTranslucencyWindow &state, int mask, const KWin::WindowPaintData &data);
+    void drawTileMask(KWin::EffectWindow *w, ColorTranslucencyWindow &state, int mask, const KWin::WindowPaintData &data);
+    void readProbes();
+    void readTileMask();
+    void updateOffscreenBytes(KWin::EffectWindow *w, ColorTranslucencyWindow &state);
+    bool shouldBypass(const KWin::EffectWindow *w) const;
+    void updateBypass(KWin::EffectWindow *w);
+    void scheduleVisibilityUpdate();
+    void updateVisibility();
+    void setSuspended(KWin::EffectWindow *w, ColorTranslucencyWindow &state, int reasons);
+    void resumeDrawn(KWin::EffectWindow *w, ColorTranslucencyWindow &state);
+    void rearmProbes();
+    ColorTranslucencyGovernor &governorFor(const KWin::EffectScreen *screen);
+    void updateThrottling();
+    void updateDegradedProfiles();
 };
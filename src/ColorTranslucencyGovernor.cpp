@@ -0,0 +1,233 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <kwinglplatform.h>
+#include <kwinglutils.h>
+#include <algorithm>
+#include "ColorTranslucencyGovernor.h"
+#include "ColorTranslucencyLogging.h"
+
+namespace
+{
+    // Weight of a new frame in the smoothed times
+    constexpr double SMOOTHING = 0.1;
+    // Over budget for this long steps down once, in ms
+    constexpr qint64 STEP_DOWN_DELAY = 500;
+    // Below this share of the budget counts as headroom
+    constexpr double HEADROOM = 0.5;
+    // Headroom for this long steps up once, doubled whenever a recovered level
+    // is left again before it could settle, in ms
+    constexpr qint64 MIN_RECOVERY_DELAY = 3000;
+    constexpr qint64 MAX_RECOVERY_DELAY = 60000;
+
+    const char *const LEVEL_NAMES[] = {"full", "reduced", "limited", "disabled"};
+}
+
+ColorTranslucencyGovernor::ColorTranslucencyGovernor()
+    : m_recoveryDelay(MIN_RECOVERY_DELAY)
+{
+    m_clock.start();
+}
+
+ColorTranslucencyGovernor::~ColorTranslucencyGovernor()
+{
+    if (!m_all.empty())
+        glDeleteQueries(GLsizei(m_all.size()), m_all.data());
+}
+
+void ColorTranslucencyGovernor::Initialize()
+{
+    if (m_initialized)
+        return;
+    m_initialized = true;
+
+    // GLES only has them through EXT_disjoint_timer_query, which can drop results
+    m_gpuTimer = !KWin::GLPlatform::instance()->isGLES() &&
+                 (KWin::hasGLVersion(3, 3) || KWin::hasGLExtension(QByteArrayLiteral("GL_ARB_timer_query")));
+    qCDebug(COLORTRANSLUCENCY) << "ColorTranslucencyGovernor::Initialize: GPU timer queries" << (m_gpuTimer ? "available" : "unavailable");
+}
+
+void ColorTranslucencyGovernor::SetBudget(qint64 budget)
+{
+    m_budget = std::max<qint64>(0, budget);
+    m_overSince = -1;
+    m_headroomSince = -1;
+}
+
+void ColorTranslucencyGovernor::SetForcedLevel(int level)
+{
+    m_forcedLevel = level >= 0 && level < LEVEL_COUNT ? level : -1;
+}
+
+void ColorTranslucencyGovernor::BeginFrame()
+{
+    if (m_gpuTimer && !m_pending.empty())
+        ReadQueries();
+}
+
+void ColorTranslucencyGovernor::BeginDraw(const void *owner)
+{
+    m_drawStart = m_clock.nsecsElapsed();
+    if (!m_gpuTimer)
+        return;
+
+    GLuint query = 0;
+    if (m_free.empty())
+    {
+        glGenQueries(1, &query);
+        m_all.push_back(query);
+    }
+    else
+    {
+        query = m_free.back();
+        m_free.pop_back();
+    }
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    m_pending.push_back({query, m_frame, owner});
+}
+
+void ColorTranslucencyGovernor::EndDraw()
+{
+    if (m_gpuTimer)
+        glEndQuery(GL_TIME_ELAPSED);
+    m_frameCpu += m_clock.nsecsElapsed() - m_drawStart;
+    m_drawn = true;
+}
+
+void ColorTranslucencyGovernor::ReadQueries()
+{
+    // Results arrive in submission order, a frame is complete once a query of
+    // a later frame is available
+    while (!m_pending.empty())
+    {
+        const Pending pending = m_pending.front();
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available != GL_TRUE)
+            break;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(pending.query, GL_QUERY_RESULT, &elapsed);
+        m_pending.pop_front();
+        m_free.push_back(pending.query);
+        if (m_gpuTimeListener)
+            m_gpuTimeListener(pending.owner, pending.frame, qint64(elapsed));
+        // Drawn at the previous level
+        if (pending.frame < m_levelFrame)
+            continue;
+
+        if (pending.frame != m_gpuFrame && m_gpuFrameTime > 0)
+        {
+            const double time = m_gpuFrameTime / 1000.0;
+            m_gpuTime = m_gpuTime > 0.0 ? m_gpuTime + SMOOTHING * (time - m_gpuTime) : time;
+            m_gpuFrameTime = 0;
+        }
+        m_gpuFrame = pending.frame;
+        m_gpuFrameTime += qint64(elapsed);
+    }
+}
+
+bool ColorTranslucencyGovernor::EndFrame()
+{
+    // Only frames the effect drew in say something about its cost
+    if (m_drawn)
+    {
+        const double time = m_frameCpu / 1000.0;
+        m_cpuTime = m_cpuTime > 0.0 ? m_cpuTime + SMOOTHING * (time - m_cpuTime) : time;
+    }
+    qCTrace() << "ColorTranslucencyGovernor::EndFrame: frame" << m_frame << "cpu" << m_frameCpu / 1000 << "us, smoothed cpu"
+              << m_cpuTime << "gpu" << m_gpuTime;
+    m_frameCpu = 0;
+    m_drawn = false;
+    m_frame++;
+
+    const Level previous = m_level;
+    if (m_forcedLevel >= 0)
+        SetLevel(Level(m_forcedLevel));
+    else if (m_budget <= 0)
+        SetLevel(LevelFull);
+    else
+    {
+        const qint64 now = m_clock.elapsed();
+        const double cost = std::max(m_cpuTime, m_gpuTime);
+        if (cost > m_budget)
+        {
+            m_headroomSince = -1;
+            if (m_overSince < 0)
+                m_overSince = now;
+            if (m_level != LevelDisabled && now - m_overSince >= STEP_DOWN_DELAY && now - m_lastChange >= STEP_DOWN_DELAY)
+            {
+                if (m_lastStepUp && now - m_lastChange < m_recoveryDelay)
+                    m_recoveryDelay = std::min(2 * m_recoveryDelay, MAX_RECOVERY_DELAY);
+                m_stepDowns++;
+                m_lastStepUp = false;
+                SetLevel(Level(m_level + 1));
+            }
+        }
+        else if (cost < m_budget * HEADROOM)
+        {
+            m_overSince = -1;
+            if (m_headroomSince < 0)
+                m_headroomSince = now;
+            if (m_level != LevelFull && now - m_headroomSince >= m_recoveryDelay && now - m_lastChange >= m_recoveryDelay)
+            {
+                m_stepUps++;
+                m_lastStepUp = true;
+                SetLevel(Level(m_level - 1));
+            }
+        }
+        else
+        {
+            m_overSince = -1;
+            m_headroomSince = -1;
+        }
+
+        // Running at full level for a while forgets earlier oscillation
+        if (m_level == LevelFull && now - m_lastChange >= MAX_RECOVERY_DELAY)
+            m_recoveryDelay = MIN_RECOVERY_DELAY;
+    }
+    return m_level != previous;
+}
+
+void ColorTranslucencyGovernor::SetLevel(Level level)
+{
+    if (level == m_level)
+        return;
+
+    qCDebugLimited(COLORTRANSLUCENCY_LIFECYCLE) << "ColorTranslucencyGovernor::SetLevel:" << LEVEL_NAMES[m_level] << "->" << LEVEL_NAMES[level]
+             << "cpu" << m_cpuTime << "gpu" << m_gpuTime << "budget" << m_budget;
+    // Windows lose their colors from here on, which users notice
+    if (level > m_level && level >= LevelLimited)
+        qCWarning(COLORTRANSLUCENCY) << "ColorTranslucencyGovernor::SetLevel:" << (level == LevelDisabled ? "no window is keyed" : "only the topmost windows are keyed")
+                                     << "while the effect takes" << std::max(m_cpuTime, m_gpuTime) << "us of the" << m_budget << "us budget";
+    m_level = level;
+    m_lastChange = m_clock.elapsed();
+    m_overSince = -1;
+    m_headroomSince = -1;
+
+    // The new level costs something else, start measuring it from scratch
+    m_cpuTime = 0.0;
+    m_gpuTime = 0.0;
+    m_gpuFrameTime = 0;
+    m_gpuFrame = m_frame;
+    m_levelFrame = m_frame;
+}
+
+const char *ColorTranslucencyGovernor::LevelName(Level level)
+{
+    return LEVEL_NAMES[level];
+}
@@ -0,0 +1,126 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <epoxy/gl.h>
+#include <deque>
+#include <functional>
+#include <vector>
+#include <QElapsedTimer>
+#include <QtGlobal>
+
+// Measures what the effect adds to every frame and steps the effect down
+// while that exceeds the budget. CPU time is taken around the effect's draws,
+// GPU time with GL_TIME_ELAPSED queries read back frames later. Both are
+// smoothed, the larger one is compared against the budget. Frames are painted
+// per output, the effect keeps one governor per output so that a slow output
+// does not step down the others.
+class ColorTranslucencyGovernor
+{
+public:
+    enum Level
+    {
+        LevelFull,     // Everything the configuration asks for
+        LevelReduced,  // No content probes or tile masks
+        LevelLimited,  // Only the topmost keyed windows
+        LevelDisabled, // No window is keyed
+    };
+    static constexpr int LEVEL_COUNT = LevelDisabled + 1;
+    static const char *LevelName(Level level);
+
+    ColorTranslucencyGovernor();
+    ~ColorTranslucencyGovernor();
+    ColorTranslucencyGovernor(const ColorTranslucencyGovernor &) = delete;
+    ColorTranslucencyGovernor &operator=(const ColorTranslucencyGovernor &) = delete;
+
+    // Needs a current GL context, without timer queries only CPU time counts
+    void Initialize();
+    // Budget per frame in µs, 0 turns the governor off
+    void SetBudget(qint64 budget);
+    // A level >= 0 is kept regardless of the measurements, -1 goes back to automatic
+    void SetForcedLevel(int level);
+
+    void BeginFrame();
+    // `owner` is handed back with the GPU time of this draw, see SetGpuTimeListener
+    void BeginDraw(const void *owner = nullptr);
+    void EndDraw();
+    // Returns true when the level changed
+    bool EndFrame();
+
+    // Called with every GPU time read back, with the owner and frame the draw
+    // belongs to. Results of draws at a previous level are reported as well.
+    void SetGpuTimeListener(std::function<void(const void *owner, quint64 frame, qint64 nanoseconds)> listener)
+    {
+        m_gpuTimeListener = std::move(listener);
+    }
+
+    Level GetLevel() const { return m_level; }
+    qint64 GetBudget() const { return m_budget; }
+    int GetForcedLevel() const { return m_forcedLevel; }
+    bool HasGpuTimer() const { return m_gpuTimer; }
+    // Smoothed time per frame in µs
+    double GetCpuTime() const { return m_cpuTime; }
+    double GetGpuTime() const { return m_gpuTime; }
+    quint64 GetStepDowns() const { return m_stepDowns; }
+    quint64 GetStepUps() const { return m_stepUps; }
+
+private:
+    struct Pending
+    {
+        GLuint query;
+        quint64 frame;
+        const void *owner;
+    };
+
+    void ReadQueries();
+    void SetLevel(Level level);
+
+    QElapsedTimer m_clock;
+    bool m_initialized = false;
+    bool m_gpuTimer = false;
+    qint64 m_budget = 0;
+    int m_forcedLevel = -1;
+    Level m_level = LevelFull;
+
+    quint64 m_frame = 0;
+    qint64 m_drawStart = 0;
+    qint64 m_frameCpu = 0;
+    bool m_drawn = false;
+    double m_cpuTime = 0.0;
+    double m_gpuTime = 0.0;
+
+    // GL_TIME_ELAPSED queries cannot nest, there is at most one open at a time
+    std::deque<Pending> m_pending;
+    std::vector<GLuint> m_free;
+    std::vector<GLuint> m_all;
+    std::function<void(const void *, quint64, qint64)> m_gpuTimeListener;
+    quint64 m_gpuFrame = 0;
+    // First frame drawn at the current level
+    quint64 m_levelFrame = 0;
+    qint64 m_gpuFrameTime = 0;
+
+    // Over budget since, and within the recovery headroom since, in ms
+    qint64 m_overSince = -1;
+    qint64 m_headroomSince = -1;
+    qint64 m_lastChange = 0;
+    // Grows when a recovered level has to be left again right away
+    qint64 m_recoveryDelay = 0;
+    bool m_lastStepUp = false;
+    quint64 m_stepDowns = 0;
+    quint64 m_stepUps = 0;
+};
@@ -0,0 +1,46 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <chrono>
+#include "ColorTranslucencyLogging.h"
+
+Q_LOGGING_CATEGORY(COLORTRANSLUCENCY, "kwin_effect_colortranslucency", QtInfoMsg)
+Q_LOGGING_CATEGORY(COLORTRANSLUCENCY_LIFECYCLE, "kwin_effect_colortranslucency.lifecycle", QtInfoMsg)
+Q_LOGGING_CATEGORY(COLORTRANSLUCENCY_SHADERS, "kwin_effect_colortranslucency.shaders", QtInfoMsg)
+Q_LOGGING_CATEGORY(COLORTRANSLUCENCY_FRAME, "kwin_effect_colortranslucency.frame", QtInfoMsg)
+
+bool ColorTranslucencyRateLimiter::Allow(const QLoggingCategory &(*category)())
+{
+    const qint64 now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (now - m_intervalStart >= INTERVAL)
+    {
+        if (m_suppressed > 0)
+            qCDebug(category) << "ColorTranslucencyRateLimiter::Allow:" << m_suppressed << "messages suppressed";
+        m_intervalStart = now;
+        m_sent = 0;
+        m_suppressed = 0;
+    }
+
+    if (m_sent >= BURST)
+    {
+        m_suppressed++;
+        return false;
+    }
+    m_sent++;
+    return true;
+}
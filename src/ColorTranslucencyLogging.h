@@ -0,0 +1,64 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <QLoggingCategory>
+
+// Debug output is off by default and switched on at runtime, for example with
+// QT_LOGGING_RULES="kwin_effect_colortranslucency.lifecycle.debug=true".
+// Warnings and errors of every category are always shown.
+Q_DECLARE_LOGGING_CATEGORY(COLORTRANSLUCENCY)
+// Windows coming and going, reconfigures, governor levels
+Q_DECLARE_LOGGING_CATEGORY(COLORTRANSLUCENCY_LIFECYCLE)
+// Shader builds, program binaries and lookup tables
+Q_DECLARE_LOGGING_CATEGORY(COLORTRANSLUCENCY_SHADERS)
+// Per-frame trace points, see qCTrace()
+Q_DECLARE_LOGGING_CATEGORY(COLORTRANSLUCENCY_FRAME)
+
+// Lets at most BURST messages of one call site through per INTERVAL and
+// reports how many were dropped once the next interval starts.
+class ColorTranslucencyRateLimiter
+{
+public:
+    static constexpr int BURST = 10;
+    static constexpr qint64 INTERVAL = 1000;
+
+    bool Allow(const QLoggingCategory &(*category)());
+
+private:
+    qint64 m_intervalStart = 0;
+    int m_sent = 0;
+    int m_suppressed = 0;
+};
+
+// qCDebug() for events that can come in storms, every use has its own limiter
+#define qCDebugLimited(category)                                                                  \
+    for (bool colortranslucencyAllowed = category().isDebugEnabled() && [] {                    \
+             static ColorTranslucencyRateLimiter limiter;                                          \
+             return &limiter;                                                                      \
+         }()->Allow(category);                                                                     \
+         colortranslucencyAllowed; colortranslucencyAllowed = false)                               \
+    qCDebug(category)
+
+// Trace points on the paint path. Without the COLORTRANSLUCENCY_TRACE build
+// option they compile to nothing, their arguments are never evaluated.
+#ifdef COLORTRANSLUCENCY_TRACE
+#define qCTrace() qCDebug(COLORTRANSLUCENCY_FRAME)
+#else
+#define qCTrace() while (false) QMessageLogger().noDebug()
+#endif
@@ -0,0 +1,155 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <algorithm>
+#include "ColorTranslucencyLogging.h"
+#include "ColorTranslucencyLut.h"
+
+namespace
+{
+    int cellOf(int component)
+    {
+        // Matches what GL_NEAREST sampling picks for component / 255.0
+        return std::min(ColorTranslucencyLut::LUT_SIZE - 1, component * ColorTranslucencyLut::LUT_SIZE / 255);
+    }
+}
+
+ColorTranslucencyLut::~ColorTranslucencyLut()
+{
+    if (m_tableTexture)
+        glDeleteTextures(1, &m_tableTexture);
+    if (m_entriesTexture)
+        glDeleteTextures(1, &m_entriesTexture);
+}
+
+bool ColorTranslucencyLut::Build(const ColorTranslucencyTargets &targets)
+{
+    struct Node
+    {
+        GLfloat red, green, blue, alpha, tolerance;
+        int next;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> first(LUT_SIZE * LUT_SIZE * LUT_SIZE, 0);
+    m_droppedCells = 0;
+
+    // Targets keep their configured order inside every chain, so the first
+    // matching target wins exactly like in the loop shader.
+    for (const auto &target : targets)
+    {
+        const int rgb[3] = {target.color.red(), target.color.green(), target.color.blue()};
+        const int tolerance = std::clamp(target.tolerance, 0, 255);
+
+        int lo[3], hi[3];
+        for (int c = 0; c < 3; c++)
+        {
+            lo[c] = cellOf(std::max(0, rgb[c] - tolerance));
+            hi[c] = cellOf(std::min(255, rgb[c] + tolerance));
+        }
+
+        for (int b = lo[2]; b <= hi[2]; b++)
+            for (int g = lo[1]; g <= hi[1]; g++)
+                for (int r = lo[0]; r <= hi[0]; r++)
+                {
+                    const int cell = (b * LUT_SIZE + g) * LUT_SIZE + r;
+
+                    int last = -1;
+                    int length = 0;
+                    for (int node = first[cell]; node; node = nodes[node - 1].next)
+                    {
+                        last = node - 1;
+                        length++;
+                    }
+
+                    if (length >= MAX_CHAIN)
+                    {
+                        m_droppedCells++;
+                        continue;
+                    }
+
+                    // Half a step of slack so that a zero tolerance still matches
+                    // the exact 8-bit color after texture sampling.
+                    nodes.push_back({rgb[0] / 255.0f, rgb[1] / 255.0f, rgb[2] / 255.0f,
+                                     target.alpha / 255.0f, (tolerance + 0.5f) / 255.0f, 0});
+                    if (last < 0)
+                        first[cell] = int(nodes.size());
+                    else
+                        nodes[last].next = int(nodes.size());
+                }
+    }
+
+    m_nodeCount = int(nodes.size());
+    m_table.assign(first.begin(), first.end());
+
+    m_width = std::clamp(m_nodeCount, 1, ROW_WIDTH);
+    m_height = 2 * std::max(1, (m_nodeCount + ROW_WIDTH - 1) / ROW_WIDTH);
+    m_nodes.assign(4 * m_width * m_height, 0.0f);
+    for (int i = 0; i < m_nodeCount; i++)
+    {
+        const int row = 2 * (i / ROW_WIDTH);
+        GLfloat *row0 = &m_nodes[4 * (row * m_width + i % ROW_WIDTH)];
+        GLfloat *row1 = &m_nodes[4 * ((row + 1) * m_width + i % ROW_WIDTH)];
+        row0[0] = nodes[i].red;
+        row0[1] = nodes[i].green;
+        row0[2] = nodes[i].blue;
+        row0[3] = nodes[i].alpha;
+        row1[0] = nodes[i].tolerance;
+        row1[1] = GLfloat(nodes[i].next);
+    }
+
+    if (m_droppedCells > 0)
+        qCWarning(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyLut::Build: too many targets close to each other," << m_droppedCells
+                                             << "cells would be missing, using the loop shader";
+    qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyLut::Build:" << targets.size() << "targets," << m_nodeCount << "nodes";
+
+    m_dirty = true;
+    return m_droppedCells == 0;
+}
+
+void ColorTranslucencyLut::Bind(int tableUnit, int entriesUnit)
+{
+    if (!m_tableTexture)
+    {
+        glGenTextures(1, &m_tableTexture);
+        glGenTextures(1, &m_entriesTexture);
+    }
+
+    glActiveTexture(GL_TEXTURE0 + tableUnit);
+    glBindTexture(GL_TEXTURE_3D, m_tableTexture);
+    if (m_dirty)
+    {
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, LUT_SIZE, LUT_SIZE, LUT_SIZE, 0, GL_RED, GL_FLOAT, m_table.data());
+    }
+
+    glActiveTexture(GL_TEXTURE0 + entriesUnit);
+    glBindTexture(GL_TEXTURE_2D, m_entriesTexture);
+    if (m_dirty)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, m_nodes.data());
+        m_dirty = false;
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+}
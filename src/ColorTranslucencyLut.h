@@ -0,0 +1,66 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <epoxy/gl.h>
+#include <vector>
+#include "ColorTranslucencyTarget.h"
+
+// Lookup textures used by colortranslucency_lut.frag.
+//
+// The RGB cube is split into LUT_SIZE^3 cells. Each cell of the 3D table holds
+// the index + 1 of the first node covering it, 0 meaning no target is near.
+// Nodes live in a LUT_SIZE-independent 2D table, ROW_WIDTH nodes per pair of
+// rows:
+//   even row: target rgb, target alpha
+//   odd row:  tolerance radius, index + 1 of the next node in the same cell
+// A fragment therefore costs one table fetch plus at most MAX_CHAIN node
+// fetches, no matter how many targets are configured. Chains bound the table
+// to MAX_CHAIN nodes per cell, which always fits a GL 3.1 texture.
+class ColorTranslucencyLut
+{
+public:
+    static constexpr int LUT_SIZE = 32;
+    static constexpr int MAX_CHAIN = 4;
+    static constexpr int ROW_WIDTH = 1024;
+
+    ColorTranslucencyLut() = default;
+    ~ColorTranslucencyLut();
+    ColorTranslucencyLut(const ColorTranslucencyLut &) = delete;
+    ColorTranslucencyLut &operator=(const ColorTranslucencyLut &) = delete;
+
+    // Builds the tables on the CPU, they are uploaded on the next Bind().
+    // Returns false if a cell is covered by more than MAX_CHAIN targets, the
+    // tables would then miss colors the loop shader matches.
+    bool Build(const ColorTranslucencyTargets &targets);
+    void Bind(int tableUnit, int entriesUnit);
+
+    int GetNodeCount() const { return m_nodeCount; }
+    int GetDroppedCells() const { return m_droppedCells; }
+
+private:
+    std::vector<GLfloat> m_table;
+    std::vector<GLfloat> m_nodes;
+    int m_nodeCount = 0;
+    int m_width = 1;
+    int m_height = 2;
+    int m_droppedCells = 0;
+    GLuint m_tableTexture = 0;
+    GLuint m_entriesTexture = 0;
+    bool m_dirty = false;
+};
@@ -0,0 +1,166 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <kwinglplatform.h>
+#include <kwinglutils.h>
+#include <cmath>
+#include "ColorTranslucencyProbe.h"
+
+ColorTranslucencyProbe::~ColorTranslucencyProbe()
+{
+    if (!m_all.empty())
+        glDeleteQueries(GLsizei(m_all.size()), m_all.data());
+    if (m_framebuffer)
+        glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+void ColorTranslucencyProbe::Bind(const ColorTranslucencyTexturePool::Texture &texture)
+{
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, m_previousViewport);
+    // A partial repaint scissors the screen, the target is always drawn whole
+    m_previousScissor = glIsEnabled(GL_SCISSOR_TEST);
+    glDisable(GL_SCISSOR_TEST);
+    if (!m_framebuffer)
+        glGenFramebuffers(1, &m_framebuffer);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture.id, 0);
+    glViewport(0, 0, m_targetSize.width(), m_targetSize.height());
+}
+
+void ColorTranslucencyProbe::Restore()
+{
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_previousFramebuffer);
+    glViewport(m_previousViewport[0], m_previousViewport[1], m_previousViewport[2], m_previousViewport[3]);
+    if (m_previousScissor)
+        glEnable(GL_SCISSOR_TEST);
+}
+
+bool ColorTranslucencyProbe::BeginTarget(const QSize &size, qreal deviceScale, QMatrix4x4 &projection)
+{
+    if (m_target.id || size.isEmpty())
+        return false;
+
+    m_targetSize = QSize(int(std::ceil(size.width() * deviceScale)), int(std::ceil(size.height() * deviceScale)));
+    // Smaller targets use the top left corner of their size class
+    m_target = m_pool.Acquire(m_targetSize);
+    Bind(m_target);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    projection.setToIdentity();
+    projection.ortho(0, size.width() * deviceScale, size.height() * deviceScale, 0, -1, 1);
+    return true;
+}
+
+void ColorTranslucencyProbe::EndTarget(bool keep)
+{
+    Restore();
+    if (keep)
+        return;
+    m_pool.Release(m_target);
+    m_target = {};
+}
+
+GLuint ColorTranslucencyProbe::CountTarget(KWin::GLShader *shader)
+{
+    if (!m_target.id)
+        return 0;
+
+    // The captured target is read, a second one of the same size only gives
+    // the draw somewhere to go; nothing is written to it
+    const ColorTranslucencyTexturePool::Texture scratch = m_pool.Acquire(m_targetSize);
+    Bind(scratch);
+
+    const float width = m_targetSize.width();
+    const float height = m_targetSize.height();
+    const float u = width / m_target.size.width();
+    const float v = height / m_target.size.height();
+    const float vertices[] = {0, 0, width, 0, width, height, 0, 0, width, height, 0, height};
+    const float texcoords[] = {0, 0, u, 0, u, v, 0, 0, u, v, 0, v};
+    QMatrix4x4 projection;
+    projection.ortho(0, width, 0, height, -1, 1);
+    shader->setUniform(KWin::GLShader::ModelViewProjectionMatrix, projection);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_target.id);
+    const GLuint query = Begin();
+    KWin::GLVertexBuffer *vbo = KWin::GLVertexBuffer::streamingBuffer();
+    vbo->reset();
+    vbo->setData(6, 2, vertices, texcoords);
+    vbo->render(GL_TRIANGLES);
+    End();
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    Restore();
+    m_pool.Release(scratch);
+    m_pool.Release(m_target);
+    m_target = {};
+    return query;
+}
+
+GLenum ColorTranslucencyProbe::Target() const
+{
+    // GLES only knows whether any sample passed, which is all the effect needs
+    return KWin::GLPlatform::instance()->isGLES() ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED;
+}
+
+GLuint ColorTranslucencyProbe::Begin()
+{
+    GLuint query = 0;
+    if (m_free.empty())
+    {
+        glGenQueries(1, &query);
+        m_all.push_back(query);
+    }
+    else
+    {
+        query = m_free.back();
+        m_free.pop_back();
+    }
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glBeginQuery(Target(), query);
+    return query;
+}
+
+void ColorTranslucencyProbe::End()
+{
+    glEndQuery(Target());
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+bool ColorTranslucencyProbe::Read(GLuint query, quint64 &samples)
+{
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available != GL_TRUE)
+        return false;
+
+    GLuint result = 0;
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT, &result);
+    samples = result;
+    return true;
+}
+
+void ColorTranslucencyProbe::Recycle(GLuint query)
+{
+    if (query)
+        m_free.push_back(query);
+}
@@ -0,0 +1,81 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <epoxy/gl.h>
+#include <vector>
+#include <QMatrix4x4>
+#include <QSize>
+#include <QtGlobal>
+#include "ColorTranslucencyTexturePool.h"
+
+namespace KWin
+{
+class GLShader;
+}
+
+// Occlusion queries counting how many fragments of a window show a target
+// color. The whole window is drawn once more at full resolution into a target
+// of its own, so no part is clipped by the viewport or falls between samples.
+// Keyed windows are drawn from their offscreen texture through the probe
+// shader. Windows KWin draws as is are captured into the target first and
+// counted from there, so probing them never redirects them. Results are read
+// back frames later, the GPU is never waited on.
+class ColorTranslucencyProbe
+{
+public:
+    explicit ColorTranslucencyProbe(ColorTranslucencyTexturePool &pool) : m_pool(pool) {}
+    ~ColorTranslucencyProbe();
+    ColorTranslucencyProbe(const ColorTranslucencyProbe &) = delete;
+    ColorTranslucencyProbe &operator=(const ColorTranslucencyProbe &) = delete;
+
+    // Redirects drawing into a cleared target for an area of `size` logical
+    // pixels. `projection` maps that area, in render target pixels at
+    // `deviceScale`, onto the target 1:1.
+    bool BeginTarget(const QSize &size, qreal deviceScale, QMatrix4x4 &projection);
+    // Restores the previous render target. With `keep` the target stays
+    // around for CountTarget(), which then has to follow.
+    void EndTarget(bool keep = false);
+    // Counts the fragments of the kept target that pass `shader`, which has to
+    // be bound already. Returns the query to pass to Read().
+    GLuint CountTarget(KWin::GLShader *shader);
+
+    // Starts counting, returns the query to pass to End() and Read()
+    GLuint Begin();
+    void End();
+    // False while the result is not available yet
+    bool Read(GLuint query, quint64 &samples);
+    // Returns a query to the pool, also when its result was never read
+    void Recycle(GLuint query);
+
+private:
+    GLenum Target() const;
+    void Bind(const ColorTranslucencyTexturePool::Texture &texture);
+    void Restore();
+
+    ColorTranslucencyTexturePool &m_pool;
+    ColorTranslucencyTexturePool::Texture m_target;
+    QSize m_targetSize;
+    GLuint m_framebuffer = 0;
+    GLint m_previousFramebuffer = 0;
+    GLint m_previousViewport[4] = {};
+    GLboolean m_previousScissor = GL_FALSE;
+
+    std::vector<GLuint> m_free;
+    std::vector<GLuint> m_all;
+};
@@ -0,0 +1,262 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <algorithm>
+#include "ColorTranslucencyLogging.h"
+#include "ColorTranslucencyRules.h"
+
+namespace
+{
+    struct TypeName
+    {
+        const char *name;
+        int type;
+    };
+
+    const TypeName TYPE_NAMES[] = {
+        {"normal", ColorTranslucencyRules::TypeNormal},
+        {"dialog", ColorTranslucencyRules::TypeDialog},
+        {"utility", ColorTranslucencyRules::TypeUtility},
+        {"dock", ColorTranslucencyRules::TypeDock},
+        {"desktop", ColorTranslucencyRules::TypeDesktop},
+        {"toolbar", ColorTranslucencyRules::TypeToolbar},
+        {"menu", ColorTranslucencyRules::TypeMenu},
+        {"splash", ColorTranslucencyRules::TypeSplash},
+        {"notification", ColorTranslucencyRules::TypeNotification},
+        {"tooltip", ColorTranslucencyRules::TypeTooltip},
+    };
+
+    // Splits on spaces outside of double quotes, the quotes are dropped
+    QStringList tokenize(const QString &entry)
+    {
+        QStringList tokens;
+        QString token;
+        bool quoted = false;
+        for (const QChar c : entry)
+        {
+            if (c == QLatin1Char('"'))
+                quoted = !quoted;
+            else if (c.isSpace() && !quoted)
+            {
+                if (!token.isEmpty())
+                    tokens.push_back(token);
+                token.clear();
+            }
+            else
+                token += c;
+        }
+        if (!token.isEmpty())
+            tokens.push_back(token);
+        return tokens;
+    }
+}
+
+bool ColorTranslucencyRules::Pattern::Compile(const QString &text)
+{
+    if (text.isEmpty())
+        return false;
+    any = false;
+
+    QString source;
+    if (text.size() > 2 && text.startsWith(QLatin1Char('/')) && text.endsWith(QLatin1Char('/')))
+        source = text.mid(1, text.size() - 2);
+    else if (text.contains(QLatin1Char('*')) || text.contains(QLatin1Char('?')) || text.contains(QLatin1Char('[')))
+        source = QRegularExpression::wildcardToRegularExpression(text);
+    else
+    {
+        exact = text.toCaseFolded();
+        return true;
+    }
+
+    expression = QRegularExpression(source, QRegularExpression::CaseInsensitiveOption);
+    if (!expression.isValid())
+        return false;
+    expression.optimize();
+    return true;
+}
+
+bool ColorTranslucencyRules::Pattern::Matches(const QString &value) const
+{
+    if (any)
+        return true;
+    if (exact.isEmpty())
+        return expression.match(value).hasMatch();
+    return value.compare(exact, Qt::CaseInsensitive) == 0;
+}
+
+bool ColorTranslucencyRules::Rule::Matches(const ColorTranslucencyRuleSubject &subject) const
+{
+    if (types && !(types & subject.types))
+        return false;
+    if (!windowClass.Matches(subject.windowClass) && !windowClass.Matches(subject.fullClass))
+        return false;
+    return title.Matches(subject.caption) && role.Matches(subject.role);
+}
+
+bool ColorTranslucencyRules::Parse(const QString &entry, Rule &rule) const
+{
+    const QStringList tokens = tokenize(entry);
+    if (tokens.isEmpty())
+        return false;
+
+    // What the KCM writes: a class and nothing else
+    if (tokens.size() == 1 && !tokens[0].contains(QLatin1Char('=')))
+        return rule.windowClass.Compile(tokens[0]);
+
+    for (const QString &token : tokens)
+    {
+        const int split = token.indexOf(QLatin1Char('='));
+        if (split <= 0)
+            return false;
+        const QString key = token.left(split).toLower();
+        const QString value = token.mid(split + 1);
+
+        if (key == QLatin1String("class"))
+        {
+            if (!rule.windowClass.Compile(value))
+                return false;
+        }
+        else if (key == QLatin1String("title"))
+        {
+            if (!rule.title.Compile(value))
+                return false;
+        }
+        else if (key == QLatin1String("role"))
+        {
+            if (!rule.role.Compile(value))
+                return false;
+        }
+        else if (key == QLatin1String("type"))
+        {
+            for (const QString &name : value.split(QLatin1Char(','), Qt::SkipEmptyParts))
+            {
+                const auto found = std::find_if(std::begin(TYPE_NAMES), std::end(TYPE_NAMES), [&name](const TypeName &type) {
+                    return name.compare(QLatin1String(type.name), Qt::CaseInsensitive) == 0;
+                });
+                if (found == std::end(TYPE_NAMES))
+                    return false;
+                rule.types |= found->type;
+            }
+        }
+        else if (key == QLatin1String("priority"))
+        {
+            bool ok = false;
+            rule.priority = value.toInt(&ok);
+            if (!ok)
+                return false;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+bool ColorTranslucencyRules::Before(int a, int b) const
+{
+    const Rule &first = m_rules[a];
+    const Rule &second = m_rules[b];
+    if (first.priority != second.priority)
+        return first.priority > second.priority;
+    if (first.include != second.include)
+        return !first.include;
+    return first.order < second.order;
+}
+
+void ColorTranslucencyRules::Compile(const QStringList &inclusions, const QStringList &exclusions)
+{
+    m_rules.clear();
+    m_exact.clear();
+    m_ordered.clear();
+    m_usesTitle = false;
+    m_rejected = 0;
+
+    const auto add = [this](const QStringList &entries, bool include) {
+        for (const QString &entry : entries)
+        {
+            Rule rule;
+            rule.include = include;
+            rule.order = int(m_rules.size());
+            rule.text = entry;
+            if (!Parse(entry, rule))
+            {
+                qCWarning(COLORTRANSLUCENCY) << "ColorTranslucencyRules::Compile: ignoring malformed rule" << entry;
+                m_rejected++;
+                continue;
+            }
+            m_rules.push_back(std::move(rule));
+        }
+    };
+    add(inclusions, true);
+    add(exclusions, false);
+
+    for (int i = 0; i < int(m_rules.size()); i++)
+    {
+        const Rule &rule = m_rules[i];
+        m_usesTitle |= !rule.title.any;
+
+        const bool exactClass = !rule.windowClass.any && !rule.windowClass.exact.isEmpty() &&
+                                rule.title.any && rule.role.any && !rule.types;
+        if (!exactClass)
+        {
+            m_ordered.push_back(i);
+            continue;
+        }
+        const auto found = m_exact.constFind(rule.windowClass.exact);
+        if (found == m_exact.constEnd() || Before(i, found.value()))
+            m_exact.insert(rule.windowClass.exact, i);
+    }
+    std::stable_sort(m_ordered.begin(), m_ordered.end(), [this](int a, int b) { return Before(a, b); });
+
+    qCDebug(COLORTRANSLUCENCY) << "ColorTranslucencyRules::Compile:" << m_rules.size() << "rules," << m_exact.size() << "exact classes,"
+             << m_ordered.size() << "patterns";
+}
+
+ColorTranslucencyRules::Match ColorTranslucencyRules::Evaluate(const ColorTranslucencyRuleSubject &subject) const
+{
+    int best = -1;
+    for (const QString *windowClass : {&subject.windowClass, &subject.fullClass})
+    {
+        const auto found = m_exact.constFind(windowClass->toCaseFolded());
+        if (found != m_exact.constEnd() && (best < 0 || Before(found.value(), best)))
+            best = found.value();
+    }
+
+    // Ordered by precedence, the first match is the best one left
+    for (const int rule : m_ordered)
+    {
+        if (best >= 0 && !Before(rule, best))
+            break;
+        if (m_rules[rule].Matches(subject))
+        {
+            best = rule;
+            break;
+        }
+    }
+
+    Match match;
+    if (best >= 0)
+    {
+        match.rule = best;
+        match.included = m_rules[best].include;
+    }
+    return match;
+}
+
+QString ColorTranslucencyRules::GetRuleText(int rule) const
+{
+    return rule >= 0 && rule < int(m_rules.size()) ? m_rules[rule].text : QString();
+}
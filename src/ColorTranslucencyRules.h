@@ -0,0 +1,124 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QRegularExpression>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+// What a window is matched on, gathered once per evaluation
+struct ColorTranslucencyRuleSubject
+{
+    // Class as shown in the KCM, "konsole" for "konsole konsole"
+    QString windowClass;
+    // Class as reported by KWin
+    QString fullClass;
+    // Only filled in when ColorTranslucencyRules::UsesTitle()
+    QString caption;
+    QString role;
+    // ColorTranslucencyRules::WindowType bits
+    int types = 0;
+};
+
+// The inclusion and exclusion lists compiled into one matcher.
+//
+// An entry is either a bare window class, matched exactly like the lists
+// always did, or space separated predicates that all have to hold:
+//   class=<pattern> title=<pattern> role=<pattern> type=<type>[,<type>...] priority=<n>
+// A pattern is exact, a glob when it contains *, ? or [, or a regular
+// expression when written /like this/. Everything matches case-insensitively,
+// values containing spaces go in double quotes. The matching rule with the
+// highest priority decides, an exclusion wins over an inclusion of the same
+// priority. Bare classes are looked up in a hash, only the remaining rules are
+// tried in order.
+class ColorTranslucencyRules
+{
+public:
+    enum WindowType
+    {
+        TypeNormal = 1 << 0,
+        TypeDialog = 1 << 1,
+        TypeUtility = 1 << 2,
+        TypeDock = 1 << 3,
+        TypeDesktop = 1 << 4,
+        TypeToolbar = 1 << 5,
+        TypeMenu = 1 << 6,
+        TypeSplash = 1 << 7,
+        TypeNotification = 1 << 8,
+        TypeTooltip = 1 << 9,
+    };
+
+    struct Match
+    {
+        bool included = false;
+        // Index into the compiled rules, -1 when nothing matched
+        int rule = -1;
+    };
+
+    void Compile(const QStringList &inclusions, const QStringList &exclusions);
+    Match Evaluate(const ColorTranslucencyRuleSubject &subject) const;
+
+    // Whether any rule looks at captions, which change far more often than classes
+    bool UsesTitle() const { return m_usesTitle; }
+    int GetRuleCount() const { return int(m_rules.size()); }
+    // The entry the rule was compiled from, as written in the configuration
+    QString GetRuleText(int rule) const;
+    int GetRejectedCount() const { return m_rejected; }
+
+private:
+    struct Pattern
+    {
+        bool any = true;
+        // Case folded, only used without an expression
+        QString exact;
+        QRegularExpression expression;
+
+        bool Compile(const QString &text);
+        bool Matches(const QString &value) const;
+    };
+
+    struct Rule
+    {
+        bool include = true;
+        int priority = 0;
+        // Position in the configuration, earlier entries win ties
+        int order = 0;
+        QString text;
+        Pattern windowClass;
+        Pattern title;
+        Pattern role;
+        int types = 0;
+
+        bool Matches(const ColorTranslucencyRuleSubject &subject) const;
+    };
+
+    bool Parse(const QString &entry, Rule &rule) const;
+    // Whether rule `a` takes precedence over rule `b`
+    bool Before(int a, int b) const;
+
+    std::vector<Rule> m_rules;
+    // Case folded class of rules that only look at the class exactly, mapped
+    // to the rule that wins for it
+    QHash<QString, int> m_exact;
+    // All other rules, by precedence
+    std::vector<int> m_ordered;
+    bool m_usesTitle = false;
+    int m_rejected = 0;
+};
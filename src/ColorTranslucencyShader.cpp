@@ -16,95 +16,453 @@
  */
 
 #include <kwinglplatform.h>
+#include <algorithm>
 #include <QFile>
 #include <QStandardPaths>
 #include <kwineffects.h>
-#include <QWidget>
-#include "ColorTranslucencyEffect.h"
+#include "ColorTranslucencyLogging.h"
 #include "ColorTranslucencyShader.h"
+#include "ColorTranslucencyShaderSource.h"
+#include "ColorTranslucencyTrace.h"
 
 #include <QElapsedTimer>
 
-ColorTranslucencyShader::ColorTranslucencyShader() : m_manager(KWin::ShaderManager::instance()),
-                                                     m_palette(QWidget().palette())
+namespace
+{
+    // Texture units used by colortranslucency_lut.frag, unit 0 is the window
+    const int LUT_TABLE_UNIT = 1;
+    const int LUT_ENTRIES_UNIT = 2;
+
+    // Builder tags of the programs that are not a loop variant, those use
+    // their color count or ColorTranslucencyShaderSource::GENERIC
+    const int LUT_TAG = -2;
+    const int PROBE_TAG = -3;
+    const int LUT_PROBE_TAG = -4;
+
+    const QByteArray PROBE_DEFINE = "#define PROBE\n";
+
+    QString loopShaderName(bool core)
+    {
+        return core ? QStringLiteral("colortranslucency_core.frag") : QStringLiteral("colortranslucency.frag");
+    }
+}
+
+ColorTranslucencyShader::ColorTranslucencyShader() : m_manager(KWin::ShaderManager::instance())
+{
+}
+
+bool ColorTranslucencyShader::Initialize()
+{
+    if (m_initialized)
+        return IsValid();
+
+    QElapsedTimer timer;
+    timer.start();
+    m_initialized = true;
+    m_cache.Initialize();
+    m_cache.SetEnabled(m_binaryCache);
+    m_builder.Initialize();
+
+    // The _core shaders use GLSL 1.40, which KWin also rewrites to 300 es on GLES
+    m_core = KWin::GLPlatform::instance()->glslVersion() >= KWin::kVersionNumber(1, 40);
+
+    m_loopSource = ReadShader(loopShaderName(m_core));
+    m_generic = GetVariant(ColorTranslucencyShaderSource::GENERIC);
+    if (IsValid())
+        qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::Initialize: shader created";
+    else
+        qCCritical(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::Initialize: no valid shaders found! ColorTranslucency will not work.";
 
+    if (m_lookupTextureRequested)
+        RequestLookupShader();
+    UpdateMatchingMode();
+
+    m_startupTime = timer.elapsed();
+    qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::Initialize: shaders ready in" << m_startupTime << "ms,"
+             << m_cache.GetHits() << "from the binary cache," << m_cache.GetMisses() << "compiled";
+    return IsValid();
+}
+
+QByteArray ColorTranslucencyShader::ReadShader(const QString &name) const
 {
-    const QString shadersDir = "kwin/shaders/";
-    const QString fragmentshader = QStandardPaths::locate(QStandardPaths::GenericDataLocation, shadersDir + QStringLiteral("colortranslucency.frag"));
-    QFile file(fragmentshader);
-    if (file.open(QFile::ReadOnly))
+    // Installed copies are only picked up while developing shaders, the
+    // embedded ones keep starting the effect off the filesystem otherwise.
+    if (m_liveShaderReload)
+    {
+        const QString path = QStandardPaths::locate(QStandardPaths::GenericDataLocation, QStringLiteral("kwin/shaders/") + name);
+        QFile installed(path);
+        if (!path.isEmpty() && installed.open(QFile::ReadOnly))
+            return installed.readAll();
+    }
+
+    QFile file(QStringLiteral(":/colortranslucency/") + name);
+    if (!file.open(QFile::ReadOnly))
     {
-        QByteArray frag = file.readAll();
-        auto shader = m_manager->generateShaderFromFile(KWin::ShaderTrait::MapTexture, QString(), fragmentshader);
+        qCCritical(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::ReadShader: no shaders found!" << name;
+        return {};
+    }
 
-#if KWIN_EFFECT_API_VERSION >= 235
-        m_shader = std::move(shader);
-#else
-        m_shader.reset(shader);
-#endif
-        file.close();
-        if (m_shader->isValid())
-        {
+    return file.readAll();
+}
+
+ColorTranslucencyShader::Variant *ColorTranslucencyShader::GetVariant(int numberOfColors)
+{
+    const VariantKey key{numberOfColors, m_core};
+    const auto it = m_variants.find(key);
+    if (it != m_variants.end())
+        return it->second.shader ? &it->second : m_generic;
+
+    // Failed compilations stay in the cache too, so they are not retried every frame
+    Variant &variant = m_variants[key];
+    const QByteArray source = SourceFor(numberOfColors);
+
+    // The generic program keeps drawing while a specialized one is built
+    if (m_generic && m_generic->shader)
+    {
+        m_builder.Request(numberOfColors, source);
+        return m_generic;
+    }
+
+    variant.shader = m_builder.Compile(source);
+    if (!variant.shader || !variant.shader->isValid())
+    {
+        qCWarning(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::GetVariant: could not compile the variant for" << numberOfColors << "colors";
+        variant.shader.reset();
+        return m_generic;
+    }
+
+    ResolveLocations(variant);
+    qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::GetVariant: compiled the variant for" << numberOfColors << "colors, core profile:" << m_core;
+    return &variant;
+}
+
+void ColorTranslucencyShader::ResolveLocations(Variant &variant) const
+{
+    variant.targetColorLocation = variant.shader->uniformLocation("targetColor");
+    variant.targetAlphaLocation = variant.shader->uniformLocation("targetAlpha");
+    variant.numberOfColorsLocation = variant.shader->uniformLocation("numberOfColors");
+    variant.uploadedGeneration = 0;
+}
+
+void ColorTranslucencyShader::RequestLookupShader()
+{
+    if (!m_core)
+    {
+        qCWarning(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::RequestLookupShader: lookup texture matching needs GLSL 1.40, using the loop shader";
+        return;
+    }
+    if (m_lutShader)
+        return;
+
+    // The loop shader keeps drawing until Update() swaps this one in
+    if (m_lutSource.isEmpty())
+        m_lutSource = ReadShader(QStringLiteral("colortranslucency_lut.frag"));
+    m_builder.Request(LUT_TAG, m_lutSource);
+}
+
+void ColorTranslucencyShader::SetupLookupShader(KWin::GLShader *shader)
+{
+    m_manager->pushShader(shader);
+    shader->setUniform("lookupTable", LUT_TABLE_UNIT);
+    shader->setUniform("lookupEntries", LUT_ENTRIES_UNIT);
+    m_manager->popShader();
+}
+
+QByteArray ColorTranslucencyShader::SourceFor(int tag) const
+{
+    switch (tag)
+    {
+    case LUT_TAG:
+        return m_lutSource;
+    case LUT_PROBE_TAG:
+        return ColorTranslucencyShaderSource::define(m_lutSource, PROBE_DEFINE);
+    case PROBE_TAG:
+        return ColorTranslucencyShaderSource::define(m_loopSource, PROBE_DEFINE);
+    default:
+        return ColorTranslucencyShaderSource::specialize(m_loopSource, tag);
+    }
+}
+
+bool ColorTranslucencyShader::Update()
+{
+    if (!m_initialized || !m_builder.HasPending())
+        return false;
 
-            for (int i = 0; i < MAX_SETS; i++)
-            {
-                QString colorName = "targetColor[" + QString::number(i) + "]";
-                m_shader_targetColor_locations[i] = m_shader->uniformLocation(colorName.toStdString().c_str());
+    // Runs from prePaintScreen, before KWin makes its context current for the frame
+    KWin::effects->makeOpenGLContextCurrent();
+    bool swapped = false;
+    for (auto &result : m_builder.Poll())
+    {
+        if (!result.shader || !result.shader->isValid())
+        {
+            // The previous program, if any, simply stays in use
+            qCWarning(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::Update: build" << result.tag << "failed, keeping the current program";
+            if (result.tag == LUT_TAG && !m_lutShader)
+                qCWarning(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::Update: lookup texture shader is not valid, lookup texture matching is disabled";
+            continue;
+        }
 
-                QString alphaName = "targetAlpha[" + QString::number(i) + "]";
-                m_shader_targetAlpha_locations[i] = m_shader->uniformLocation(alphaName.toStdString().c_str());
-                qDebug() << "ColorTranslucencyShader::ColorTranslucencyShader: fragment shader m_shader_targetColor_locations: " << m_shader_targetColor_locations;
-                qDebug() << "ColorTranslucencyShader::ColorTranslucencyShader: fragment shader m_shader_targetAlpha_locations: " << m_shader_targetAlpha_locations;
-            }
+        // Dropped if the sources were reloaded again in the meantime
+        if (result.fragmentSource != SourceFor(result.tag))
+            continue;
 
-            m_shader_numberOfColors_location = m_shader->uniformLocation("numberOfColors");
-            qDebug() << "ColorTranslucencyShader::ColorTranslucencyShader: shader created";
-            qDebug() << "ColorTranslucencyShader::ColorTranslucencyShader: fragment shader path: " << fragmentshader;
+        if (result.tag == LUT_TAG || result.tag == LUT_PROBE_TAG)
+        {
+            auto &target = result.tag == LUT_TAG ? m_lutShader : m_lutProbeShader;
+            target = std::move(result.shader);
+            SetupLookupShader(target.get());
         }
         else
-            qCritical() << "ColorTranslucencyShader::ColorTranslucencyShader: no valid shaders found! ColorTranslucency will not work.";
+        {
+            Variant &variant = m_variants[{result.tag, m_core}];
+            variant.shader = std::move(result.shader);
+            ResolveLocations(variant);
+            if (result.tag == ColorTranslucencyShaderSource::GENERIC)
+                m_generic = &variant;
+        }
+        qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::Update: swapped in program" << result.tag;
+        swapped = true;
     }
-    else
+
+    if (swapped)
     {
-        qCritical() << "ColorTranslucencyShader::ColorTranslucencyShader: no shaders found!";
+        // Picked again on the next Bind(), now that a better program may exist
+        for (auto &set : m_sets)
+            set->variant = nullptr;
+        UpdateMatchingMode();
     }
+    return swapped;
+}
+
+void ColorTranslucencyShader::ReloadSources()
+{
+    if (!m_initialized)
+        return;
+
+    m_loopSource = ReadShader(loopShaderName(m_core));
+    for (const auto &[key, variant] : m_variants)
+        m_builder.Request(key.first, SourceFor(key.first));
+
+    // The lookup texture shader is only rebuilt if it is in use
+    if (m_core && (m_lutShader || m_lookupTextureRequested))
+    {
+        m_lutSource = ReadShader(QStringLiteral("colortranslucency_lut.frag"));
+        m_builder.Request(LUT_TAG, m_lutSource);
+        if (m_lutProbeRequested)
+            m_builder.Request(LUT_PROBE_TAG, SourceFor(LUT_PROBE_TAG));
+    }
+    qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::ReloadSources: rebuilding" << m_builder.GetPendingCount() << "programs";
 }
 
 bool ColorTranslucencyShader::IsValid() const
 {
-    return m_shader && m_shader->isValid();
+    // Shaders are only built on first use, until then assume they will work
+    if (!m_initialized)
+        return true;
+    return m_generic && m_generic->shader && m_generic->shader->isValid();
+}
+
+bool ColorTranslucencyShader::IsLookupTextureSupported() const
+{
+    return m_lutShader && m_lutShader->isValid();
+}
+
+KWin::GLShader *ColorTranslucencyShader::GetShader(int profile) const
+{
+    const UniformSet *set = profile >= 0 && profile < int(m_sets.size()) ? m_sets[profile].get() : nullptr;
+    if (m_useLookupTexture && (!set || set->lutComplete))
+        return m_lutShader.get();
+    if (set && set->variant)
+        return set->variant->shader.get();
+    return m_generic ? m_generic->shader.get() : nullptr;
+}
+
+int ColorTranslucencyShader::GetDroppedColors(int profile) const
+{
+    if (profile < 0 || profile >= int(m_sets.size()))
+        return 0;
+    const UniformSet &set = *m_sets[profile];
+    return UsesLookupTexture(set) ? 0 : set.targetCount - set.numberOfColors;
 }
 
-const std::unique_ptr<KWin::GLShader> &
-ColorTranslucencyShader::Bind(KWin::EffectWindow *) const
+void ColorTranslucencyShader::UpdateMatchingMode()
 {
-    QVector<QColor> targetColors = ColorTranslucencyEffect::getActiveColors();
-    QVector<int> targetAlphas = ColorTranslucencyEffect::getActiveAlphas();
+    m_useLookupTexture = m_lookupTextureRequested && IsLookupTextureSupported();
+}
+
+void ColorTranslucencyShader::SetTargets(const QVector<ColorTranslucencyTargets> &profiles, bool useLookupTexture,
+                                         bool specialize)
+{
+    // Support for lookup textures is only known once the shader is built,
+    // so the tables are prepared whenever they are asked for.
+    m_lookupTextureRequested = useLookupTexture;
+    if (useLookupTexture && m_initialized && !m_lutShader)
+    {
+        KWin::effects->makeOpenGLContextCurrent();
+        RequestLookupShader();
+    }
+    UpdateMatchingMode();
 
-    m_manager->pushShader(m_shader.get());
+    // Dropped profiles take their lookup textures with them
+    const int count = std::max(1, int(profiles.size()));
+    if (count < int(m_sets.size()) && m_initialized)
+        KWin::effects->makeOpenGLContextCurrent();
+    m_sets.resize(count);
+    Release();
 
-    // Set normalized target colors
-    for (int i = 0; i < targetColors.size(); i++)
+    for (int profile = 0; profile < count; profile++)
     {
-        QVector4D normalizedColor(targetColors[i].redF(), targetColors[i].greenF(), targetColors[i].blueF(), targetColors[i].alphaF());
-        m_shader->setUniform(m_shader_targetColor_locations[i], normalizedColor);
+        if (!m_sets[profile])
+            m_sets[profile] = std::make_unique<UniformSet>();
+        PackSet(profile, profile < profiles.size() ? profiles[profile] : ColorTranslucencyTargets());
     }
+    m_specialize = specialize;
+}
+
+void ColorTranslucencyShader::SetProfileTargets(int profile, const ColorTranslucencyTargets &targets)
+{
+    if (profile < 0 || profile >= int(m_sets.size()))
+        return;
+    Release();
+    PackSet(profile, targets);
+}
+
+void ColorTranslucencyShader::PackSet(int profile, const ColorTranslucencyTargets &targets)
+{
+    UniformSet &set = *m_sets[profile];
+    set.lutComplete = m_lookupTextureRequested && set.lut.Build(targets);
+    if (!set.lutComplete && targets.size() > MAX_SETS)
+        qCWarning(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShader::PackSet: only the first" << MAX_SETS << "colors of profile" << profile
+                   << "are used without lookup texture matching";
+    set.targetCount = targets.size();
+    set.numberOfColors = std::min<int>(targets.size(), MAX_SETS);
 
-    // Set normalized target alphas
-    for (int i = 0; i < targetAlphas.size(); i++)
+    // Normalize once here so that drawing a window never touches a QColor
+    for (int i = 0; i < set.numberOfColors; i++)
     {
-        float normalizedAlpha = targetAlphas[i] / 255.0f;
-        m_shader->setUniform(m_shader_targetAlpha_locations[i], normalizedAlpha);
+        const QColor &color = targets[i].color;
+        set.targetColors[4 * i + 0] = color.redF();
+        set.targetColors[4 * i + 1] = color.greenF();
+        set.targetColors[4 * i + 2] = color.blueF();
+        set.targetColors[4 * i + 3] = color.alphaF();
+        set.targetAlphas[i] = targets[i].alpha / 255.0f;
     }
 
-    // Set number of active colors
-    m_shader->setUniform(m_shader_numberOfColors_location, targetColors.size());
+    // The variant is picked on the next Bind(), when a GL context is current
+    set.variant = nullptr;
+    set.generation = ++m_uniformGeneration;
+}
 
-    return m_shader;
+ColorTranslucencyShader::UniformSet &ColorTranslucencyShader::GetSet(int profile)
+{
+    // Windows keep their profile index until they are matched again
+    if (profile < 0 || profile >= int(m_sets.size()))
+        profile = 0;
+    if (m_sets.empty())
+        m_sets.push_back(std::make_unique<UniformSet>());
+    return *m_sets[profile];
 }
 
-void ColorTranslucencyShader::Unbind() const
+KWin::GLShader *ColorTranslucencyShader::Bind(int profile)
 {
+    const ColorTranslucencyTraceSpan span("ColorTranslucencyShader::Bind");
+    if (!m_initialized && !Initialize())
+        return nullptr;
+
+    UniformSet &set = GetSet(profile);
+    Variant *variant = nullptr;
+    if (!UsesLookupTexture(set))
+    {
+        if (!set.variant)
+            set.variant = m_specialize ? GetVariant(set.numberOfColors) : m_generic;
+        variant = set.variant;
+    }
+    return BindProgram(variant ? variant->shader.get() : m_lutShader.get(), variant, set);
+}
+
+KWin::GLShader *ColorTranslucencyShader::BindProbe(int profile)
+{
+    if (!m_initialized || !IsValid())
+        return nullptr;
+
+    // Built in the background on first use, there is no fallback for a probe
+    if (UsesLookupTexture(GetSet(profile)))
+    {
+        if (!m_lutProbeShader)
+        {
+            if (!m_lutProbeRequested)
+                m_builder.Request(LUT_PROBE_TAG, SourceFor(LUT_PROBE_TAG));
+            m_lutProbeRequested = true;
+            return nullptr;
+        }
+        return BindProgram(m_lutProbeShader.get(), nullptr, GetSet(profile));
+    }
+
+    const VariantKey key{PROBE_TAG, m_core};
+    const auto it = m_variants.find(key);
+    if (it == m_variants.end())
+    {
+        m_variants[key];
+        m_builder.Request(PROBE_TAG, SourceFor(PROBE_TAG));
+        return nullptr;
+    }
+    if (!it->second.shader)
+        return nullptr;
+    return BindProgram(it->second.shader.get(), &it->second, GetSet(profile));
+}
+
+KWin::GLShader *ColorTranslucencyShader::BindProgram(KWin::GLShader *shader, Variant *variant, UniformSet &set)
+{
+    // KWin and other effects bind their own programs and texture units between
+    // two draws, so every draw pushes the program and binds the tables again
+    Release();
+    m_manager->pushShader(shader);
+    m_boundShader = shader;
+    m_frameCounters.binds++;
+    m_frameCounters.glCalls++;
+
+    if (UsesLookupTexture(set))
+    {
+        set.lut.Bind(LUT_TABLE_UNIT, LUT_ENTRIES_UNIT);
+        m_frameCounters.glCalls += 5;
+    }
+
+    // Uniforms are program state, so each variant only needs them after a change
+    if (variant && variant->uploadedGeneration != set.generation)
+    {
+        if (set.numberOfColors > 0)
+        {
+            glUniform4fv(variant->targetColorLocation, set.numberOfColors, set.targetColors.data());
+            glUniform1fv(variant->targetAlphaLocation, set.numberOfColors, set.targetAlphas.data());
+            m_frameCounters.glCalls += 2;
+        }
+        variant->shader->setUniform(variant->numberOfColorsLocation, set.numberOfColors);
+        m_frameCounters.glCalls++;
+        m_frameCounters.uploads++;
+        variant->uploadedGeneration = set.generation;
+        qCTrace() << "ColorTranslucencyShader::BindProgram: uploaded" << set.numberOfColors << "colors of generation" << set.generation;
+    }
+
+    return shader;
+}
+
+void ColorTranslucencyShader::Release()
+{
+    if (!m_boundShader)
+        return;
+
+    const ColorTranslucencyTraceSpan span("ColorTranslucencyShader::Release");
     m_manager->popShader();
-    qDebug() << "ColorTranslucencyShader::Unbind: unbinding shader";
+    m_boundShader = nullptr;
+}
+
+void ColorTranslucencyShader::EndFrame()
+{
+    Release();
+
+    m_totalCounters.binds += m_frameCounters.binds;
+    m_totalCounters.uploads += m_frameCounters.uploads;
+    m_totalCounters.glCalls += m_frameCounters.glCalls;
+    m_lastFrameCounters = m_frameCounters;
+    m_frameCounters = {};
 }
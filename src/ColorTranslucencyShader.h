@@ -19,9 +19,14 @@
 #define KWIN4_COLORTRANSLUCENCY_CONFIG_SHADERMANAGER_H
 
 #include <kwinglutils.h>
+#include <array>
+#include <map>
 #include <memory>
-#include <QPalette>
-#include "ColorTranslucencyConfig.h"
+#include <vector>
+#include "ColorTranslucencyLut.h"
+#include "ColorTranslucencyShaderBuilder.h"
+#include "ColorTranslucencyShaderCache.h"
+#include "ColorTranslucencyTarget.h"
 
 const int MAX_SETS = 10;
 
@@ -34,22 +39,132 @@ namespace KWin
 class ColorTranslucencyShader
 {
 public:
+    // GL work done on behalf of the effect, counted per painted frame.
+    struct Counters
+    {
+        quint64 binds = 0;
+        quint64 uploads = 0;
+        quint64 glCalls = 0;
+    };
+
     ColorTranslucencyShader();
 
+    // Builds the shaders, needs a current GL context. Called on first use.
+    bool Initialize();
+    bool IsInitialized() const { return m_initialized; }
     bool IsValid() const;
-    const std::unique_ptr<KWin::GLShader> &Bind(KWin::EffectWindow *w) const;
-    // const std::unique_ptr<KWin::GLShader>& Bind(QMatrix4x4 mvp, KWin::EffectWindow *w) const;
-    void Unbind() const;
-    std::unique_ptr<KWin::GLShader> &GetShader() { return m_shader; }
+    // Binds the program and uniforms of a color profile, 0 being the global
+    // targets, until Release(). Uniforms are only uploaded after a change.
+    KWin::GLShader *Bind(int profile);
+    // Binds the coverage probe, which discards every fragment that does not
+    // show a target color of the profile. nullptr while it is still being built.
+    KWin::GLShader *BindProbe(int profile);
+    void Release();
+    void EndFrame();
+    // Swaps in programs that finished building, call between frames.
+    // Returns true when anything on screen may have changed.
+    bool Update();
+    bool HasPendingBuilds() const { return m_builder.HasPending(); }
+    // Re-reads the shader sources and rebuilds every program in the background
+    void ReloadSources();
+    // Prefer installed shader sources over the embedded ones, see ReadShader()
+    void SetLiveShaderReload(bool enabled) { m_liveShaderReload = enabled; }
+    // Takes effect for the next program loaded or built
+    void SetBinaryCache(bool enabled)
+    {
+        m_binaryCache = enabled;
+        m_cache.SetEnabled(enabled);
+    }
+    // One entry per color profile, the first one holds the global targets
+    void SetTargets(const QVector<ColorTranslucencyTargets> &profiles, bool useLookupTexture, bool specialize);
+    // Repacks a single profile set by SetTargets(), keeping the matching options
+    void SetProfileTargets(int profile, const ColorTranslucencyTargets &targets);
+    int GetProfileCount() const { return int(m_sets.size()); }
+    // Colors of a profile beyond MAX_SETS that are not matched, because the
+    // loop shader draws it while the lookup tables cannot hold all of them
+    int GetDroppedColors(int profile) const;
+    KWin::GLShader *GetShader(int profile = 0) const;
+    bool IsLookupTextureSupported() const;
+    const Counters &GetLastFrameCounters() const { return m_lastFrameCounters; }
+    const Counters &GetTotalCounters() const { return m_totalCounters; }
+    const ColorTranslucencyShaderCache &GetCache() const { return m_cache; }
+    qint64 GetStartupTime() const { return m_startupTime; }
 
 private:
-    std::unique_ptr<KWin::GLShader> m_shader;
+    // A loop shader program, either generic or with the color count baked in
+    struct Variant
+    {
+        std::unique_ptr<KWin::GLShader> shader;
+        int targetColorLocation = -1;
+        int targetAlphaLocation = -1;
+        int numberOfColorsLocation = -1;
+        quint64 uploadedGeneration = 0;
+    };
+    // Color count (or ColorTranslucencyShaderSource::GENERIC) and core profile
+    using VariantKey = std::pair<int, bool>;
+
+    QByteArray ReadShader(const QString &name) const;
+    Variant *GetVariant(int numberOfColors);
+    QByteArray SourceFor(int tag) const;
+    void ResolveLocations(Variant &variant) const;
+    void SetupLookupShader(KWin::GLShader *shader);
+    void RequestLookupShader();
+    struct UniformSet;
+    UniformSet &GetSet(int profile);
+    void PackSet(int profile, const ColorTranslucencyTargets &targets);
+    bool UsesLookupTexture(const UniformSet &set) const { return m_useLookupTexture && set.lutComplete; }
+    KWin::GLShader *BindProgram(KWin::GLShader *shader, Variant *variant, UniformSet &set);
+    void UpdateMatchingMode();
+
     KWin::ShaderManager *m_manager;
-    QPalette m_palette;
+    bool m_initialized = false;
+    bool m_core = false;
+    bool m_liveShaderReload = false;
+    bool m_binaryCache = true;
+    ColorTranslucencyShaderCache m_cache;
+    ColorTranslucencyShaderBuilder m_builder{m_cache};
+    qint64 m_startupTime = 0;
+
+    QByteArray m_loopSource;
+    std::map<VariantKey, Variant> m_variants;
+    Variant *m_generic = nullptr;
+    bool m_specialize = true;
+
+    // Uniform block of a color profile, packed once per reconfigure in the
+    // layout glUniform*v expects. Generations are unique across profiles, a
+    // variant uploads a block again only when it last drew another profile.
+    struct UniformSet
+    {
+        std::array<GLfloat, 4 * MAX_SETS> targetColors{};
+        std::array<GLfloat, MAX_SETS> targetAlphas{};
+        int numberOfColors = 0;
+        // All colors of the profile, numberOfColors only counts the uniforms
+        int targetCount = 0;
+        quint64 generation = 0;
+        // Picked on the first Bind() after a change
+        Variant *variant = nullptr;
+        ColorTranslucencyLut lut;
+        // False when the tables miss colors, the loop shader matches the profile then
+        bool lutComplete = false;
+    };
+    // unique_ptr keeps the lookup textures in place while the list changes
+    std::vector<std::unique_ptr<UniformSet>> m_sets;
+    quint64 m_uniformGeneration = 0;
+
+    // Used instead of the loop shaders when lookup texture matching is on,
+    // built in the background the first time it is turned on
+    QByteArray m_lutSource;
+    std::unique_ptr<KWin::GLShader> m_lutShader;
+    std::unique_ptr<KWin::GLShader> m_lutProbeShader;
+    bool m_lutProbeRequested = false;
+    bool m_lookupTextureRequested = false;
+    bool m_useLookupTexture = false;
+
+    KWin::GLShader *m_boundShader = nullptr;
 
-    int m_shader_targetColor_locations[MAX_SETS];
-    int m_shader_targetAlpha_locations[MAX_SETS];
-    int m_shader_numberOfColors_location;
+    Counters m_frameCounters;
+    Counters m_lastFrameCounters;
+    Counters m_totalCounters;
 };
 
 #endif // KWIN4_COLORTRANSLUCENCY_CONFIG_SHADERMANAGER_H
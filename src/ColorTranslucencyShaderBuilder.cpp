@@ -0,0 +1,199 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <kwinglplatform.h>
+#include <algorithm>
+#include "ColorTranslucencyLogging.h"
+#include "ColorTranslucencyShaderBuilder.h"
+#include "ColorTranslucencyShaderCache.h"
+#include "ColorTranslucencyTrace.h"
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace
+{
+    // Same rewriting GLShader::load() does, the sources target desktop GL
+    QByteArray prepareSource(const QByteArray &source)
+    {
+        auto platform = KWin::GLPlatform::instance();
+        QByteArray prepared;
+        if (platform->isGLES() && platform->glslVersion() < KWin::kVersionNumber(3, 0))
+            prepared.append("precision highp float;\n");
+        prepared.append(source);
+        if (platform->isGLES() && platform->glslVersion() >= KWin::kVersionNumber(3, 0))
+            prepared.replace("#version 140", "#version 300 es\n\nprecision highp float;\n");
+        return prepared;
+    }
+}
+
+ColorTranslucencyShaderBuilder::ColorTranslucencyShaderBuilder(ColorTranslucencyShaderCache &cache)
+    : m_cache(cache)
+    , m_manager(KWin::ShaderManager::instance())
+{
+}
+
+ColorTranslucencyShaderBuilder::~ColorTranslucencyShaderBuilder()
+{
+    for (const auto &job : m_jobs)
+        if (job.program)
+            glDeleteProgram(job.program);
+}
+
+void ColorTranslucencyShaderBuilder::Initialize()
+{
+    const bool extension = KWin::hasGLExtension(QByteArrayLiteral("GL_KHR_parallel_shader_compile")) ||
+                           KWin::hasGLExtension(QByteArrayLiteral("GL_ARB_parallel_shader_compile"));
+    m_parallel = extension && m_cache.IsSupported();
+    qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShaderBuilder::Initialize: parallel shader compilation:" << m_parallel;
+}
+
+std::unique_ptr<KWin::GLShader> ColorTranslucencyShaderBuilder::Compile(const QByteArray &fragmentSource)
+{
+    if (fragmentSource.isEmpty())
+        return nullptr;
+
+    const ColorTranslucencyTraceSpan span("ColorTranslucencyShaderBuilder::Compile");
+    if (auto cached = m_cache.Load(fragmentSource))
+        return cached;
+
+    auto generated = m_manager->generateCustomShader(KWin::ShaderTrait::MapTexture, QByteArray(), fragmentSource);
+#if KWIN_EFFECT_API_VERSION >= 235
+    std::unique_ptr<KWin::GLShader> shader = std::move(generated);
+#else
+    std::unique_ptr<KWin::GLShader> shader(generated);
+#endif
+    m_cache.Store(shader.get(), fragmentSource);
+    return shader;
+}
+
+void ColorTranslucencyShaderBuilder::Request(int tag, const QByteArray &fragmentSource)
+{
+    const auto it = std::find_if(m_jobs.begin(), m_jobs.end(), [tag](const Job &job) { return job.tag == tag; });
+    if (it != m_jobs.end())
+    {
+        if (it->fragmentSource == fragmentSource)
+            return;
+        if (it->program)
+            glDeleteProgram(it->program);
+        m_jobs.erase(it);
+    }
+
+    Job job;
+    job.tag = tag;
+    job.fragmentSource = fragmentSource;
+    // A cache hit is cheap enough to be handed out on the next poll as is
+    job.shader = m_cache.Load(fragmentSource);
+    if (!job.shader && m_parallel)
+        job.program = StartProgram(fragmentSource);
+    m_jobs.push_back(std::move(job));
+}
+
+GLuint ColorTranslucencyShaderBuilder::CompileStage(GLenum type, const QByteArray &source) const
+{
+    const QByteArray prepared = prepareSource(source);
+    const char *data = prepared.constData();
+    const GLint length = prepared.size();
+
+    const GLuint stage = glCreateShader(type);
+    glShaderSource(stage, 1, &data, &length);
+    glCompileShader(stage);
+    return stage;
+}
+
+GLuint ColorTranslucencyShaderBuilder::StartProgram(const QByteArray &fragmentSource) const
+{
+    // Nothing in here waits for the driver, errors only show up once linked
+    const ColorTranslucencyTraceSpan span("ColorTranslucencyShaderBuilder::StartProgram");
+    const GLuint vertex = CompileStage(GL_VERTEX_SHADER, m_manager->generateVertexSource(KWin::ShaderTrait::MapTexture));
+    const GLuint fragment = CompileStage(GL_FRAGMENT_SHADER, fragmentSource);
+
+    const GLuint program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glBindAttribLocation(program, KWin::VA_Position, "position");
+    glBindAttribLocation(program, KWin::VA_TexCoord, "texcoord");
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+
+    // The program keeps the stages alive until it is deleted
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+    return program;
+}
+
+std::unique_ptr<KWin::GLShader> ColorTranslucencyShaderBuilder::FinishProgram(Job &job)
+{
+    const ColorTranslucencyTraceSpan span("ColorTranslucencyShaderBuilder::FinishProgram");
+    GLint linked = GL_FALSE;
+    glGetProgramiv(job.program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE)
+    {
+        GLint length = 0;
+        glGetProgramiv(job.program, GL_INFO_LOG_LENGTH, &length);
+        QByteArray log(std::max(length, 1), '\0');
+        glGetProgramInfoLog(job.program, log.size(), nullptr, log.data());
+        qCWarning(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShaderBuilder::FinishProgram: program failed to link:" << log.constData();
+        return nullptr;
+    }
+
+    return m_cache.Adopt(job.program, job.fragmentSource);
+}
+
+std::vector<ColorTranslucencyShaderBuilder::Result> ColorTranslucencyShaderBuilder::Poll()
+{
+    std::vector<Result> results;
+    bool compiledThisFrame = false;
+
+    for (auto it = m_jobs.begin(); it != m_jobs.end();)
+    {
+        Job &job = *it;
+        if (!job.shader)
+        {
+            if (job.program)
+            {
+                GLint completed = GL_FALSE;
+                glGetProgramiv(job.program, GL_COMPLETION_STATUS_KHR, &completed);
+                if (completed != GL_TRUE)
+                {
+                    ++it;
+                    continue;
+                }
+                job.shader = FinishProgram(job);
+                glDeleteProgram(job.program);
+                job.program = 0;
+            }
+            else
+            {
+                // Serial fallback, keep it to one compilation per frame
+                if (compiledThisFrame)
+                {
+                    ++it;
+                    continue;
+                }
+                job.shader = Compile(job.fragmentSource);
+                compiledThisFrame = true;
+            }
+        }
+
+        results.push_back({job.tag, std::move(job.fragmentSource), std::move(job.shader)});
+        it = m_jobs.erase(it);
+    }
+
+    return results;
+}
@@ -0,0 +1,79 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <kwinglutils.h>
+#include <memory>
+#include <vector>
+#include <QByteArray>
+
+class ColorTranslucencyShaderCache;
+
+// Builds shader programs without stalling the frame that asks for them.
+//
+// KWin's GL context cannot be shared with a worker thread, so programs are
+// linked with KHR_parallel_shader_compile and polled once per frame instead;
+// the driver compiles them on its own threads. Finished programs are turned
+// into GLShaders through their program binary. Without the extension or
+// program binaries one pending program is compiled per frame.
+class ColorTranslucencyShaderBuilder
+{
+public:
+    struct Result
+    {
+        int tag = 0;
+        QByteArray fragmentSource;
+        std::unique_ptr<KWin::GLShader> shader;
+    };
+
+    explicit ColorTranslucencyShaderBuilder(ColorTranslucencyShaderCache &cache);
+    ~ColorTranslucencyShaderBuilder();
+    ColorTranslucencyShaderBuilder(const ColorTranslucencyShaderBuilder &) = delete;
+    ColorTranslucencyShaderBuilder &operator=(const ColorTranslucencyShaderBuilder &) = delete;
+
+    // Needs a current GL context, after the cache has been initialized
+    void Initialize();
+    bool IsParallel() const { return m_parallel; }
+
+    // Compiles right away, used when there is no program to fall back to
+    std::unique_ptr<KWin::GLShader> Compile(const QByteArray &fragmentSource);
+    // Starts building `fragmentSource`, replacing any pending build with the same tag
+    void Request(int tag, const QByteArray &fragmentSource);
+    bool HasPending() const { return !m_jobs.empty(); }
+    int GetPendingCount() const { return int(m_jobs.size()); }
+    // Returns the builds that finished since the last call, failed ones with a null shader
+    std::vector<Result> Poll();
+
+private:
+    struct Job
+    {
+        int tag = 0;
+        QByteArray fragmentSource;
+        GLuint program = 0;
+        std::unique_ptr<KWin::GLShader> shader;
+    };
+
+    GLuint StartProgram(const QByteArray &fragmentSource) const;
+    GLuint CompileStage(GLenum type, const QByteArray &source) const;
+    std::unique_ptr<KWin::GLShader> FinishProgram(Job &job);
+
+    ColorTranslucencyShaderCache &m_cache;
+    KWin::ShaderManager *m_manager;
+    bool m_parallel = false;
+    std::vector<Job> m_jobs;
+};
@@ -0,0 +1,232 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <kwineffects.h>
+#include <kwinglplatform.h>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QDirIterator>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include "ColorTranslucencyLogging.h"
+#include "ColorTranslucencyShaderCache.h"
+
+namespace
+{
+    // Only used to get a linked program object out of KWin, glProgramBinary
+    // replaces it entirely.
+    const QByteArray STUB_VERTEX = "void main() { gl_Position = vec4(0.0); }\n";
+    const QByteArray STUB_FRAGMENT = "void main() { gl_FragColor = vec4(0.0); }\n";
+    const QByteArray STUB_VERTEX_CORE = "#version 140\nvoid main() { gl_Position = vec4(0.0); }\n";
+    const QByteArray STUB_FRAGMENT_CORE = "#version 140\nout vec4 fragColor;\nvoid main() { fragColor = vec4(0.0); }\n";
+
+    const quint32 CACHE_MAGIC = 0x43544243; // "CTBC"
+
+    // KWin only lets subclasses create a program from source without the
+    // ShaderManager, which is what loading a binary needs.
+    class CachedShader : public KWin::GLShader
+    {
+    public:
+        CachedShader() : KWin::GLShader(KWin::GLShader::ExplicitLinking) {}
+
+        bool loadBinary(GLenum format, const QByteArray &binary)
+        {
+            const bool core = KWin::GLPlatform::instance()->glslVersion() >= KWin::kVersionNumber(1, 40);
+            if (!load(core ? STUB_VERTEX_CORE : STUB_VERTEX, core ? STUB_FRAGMENT_CORE : STUB_FRAGMENT) || !link())
+                return false;
+
+            auto manager = KWin::ShaderManager::instance();
+            manager->pushShader(this);
+            GLint program = 0;
+            glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+            glProgramBinary(program, format, binary.constData(), binary.size());
+            GLint linked = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            manager->popShader();
+            return linked == GL_TRUE;
+        }
+    };
+
+    GLuint programOf(KWin::GLShader *shader)
+    {
+        auto manager = KWin::ShaderManager::instance();
+        manager->pushShader(shader);
+        GLint program = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+        manager->popShader();
+        return program;
+    }
+}
+
+void ColorTranslucencyShaderCache::Initialize()
+{
+    const bool hasProgramBinary = KWin::GLPlatform::instance()->isGLES()
+                                      ? KWin::hasGLVersion(3, 0)
+                                      : KWin::hasGLVersion(4, 1) || KWin::hasGLExtension(QByteArrayLiteral("GL_ARB_get_program_binary"));
+    GLint formats = 0;
+    if (hasProgramBinary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    m_supported = formats > 0;
+
+    m_directory = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/colortranslucency");
+    m_driver = QByteArray(reinterpret_cast<const char *>(glGetString(GL_VENDOR))) + '\n' +
+               QByteArray(reinterpret_cast<const char *>(glGetString(GL_RENDERER))) + '\n' +
+               QByteArray(reinterpret_cast<const char *>(glGetString(GL_VERSION))) + '\n' +
+               QCoreApplication::applicationVersion().toUtf8() + '\n' +
+               QByteArray::number(KWIN_EFFECT_API_VERSION);
+
+    // Entries of an older effect or another driver can never be hit again
+    QCryptographicHash generation(QCryptographicHash::Sha1);
+    generation.addData(m_driver);
+    QDirIterator embedded(QStringLiteral(":/colortranslucency"), QDir::Files);
+    QStringList shaders;
+    while (embedded.hasNext())
+        shaders.push_back(embedded.next());
+    shaders.sort();
+    for (const auto &path : shaders)
+    {
+        QFile shader(path);
+        if (shader.open(QFile::ReadOnly))
+            generation.addData(shader.readAll());
+    }
+    m_generation = QString::fromLatin1(generation.result().toHex().left(16));
+    Prune();
+
+    if (!m_supported)
+        qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShaderCache: program binaries are not supported by the driver";
+}
+
+void ColorTranslucencyShaderCache::Prune() const
+{
+    // Done off the compositor thread, the directory may have piled up entries
+    QThreadPool::globalInstance()->start([directory = m_directory, prefix = m_generation + QLatin1Char('-')]() {
+        int removed = 0;
+        QDirIterator entries(directory, {QStringLiteral("*.bin")}, QDir::Files);
+        while (entries.hasNext())
+        {
+            entries.next();
+            if (!entries.fileName().startsWith(prefix) && QFile::remove(entries.filePath()))
+                removed++;
+        }
+        if (removed > 0)
+            qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShaderCache::Prune: removed" << removed << "stale entries";
+    });
+}
+
+void ColorTranslucencyShaderCache::SetEnabled(bool enabled)
+{
+    m_enabled = enabled;
+}
+
+QString ColorTranslucencyShaderCache::CachePath(const QByteArray &fragmentSource) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(m_driver);
+    hash.addData(QByteArray::number(int(KWin::ShaderTrait::MapTexture)));
+    hash.addData(fragmentSource);
+    return m_directory + QLatin1Char('/') + m_generation + QLatin1Char('-') + QString::fromLatin1(hash.result().toHex()) + QStringLiteral(".bin");
+}
+
+std::unique_ptr<KWin::GLShader> ColorTranslucencyShaderCache::Load(const QByteArray &fragmentSource)
+{
+    if (!m_supported || !m_enabled)
+        return nullptr;
+
+    QFile file(CachePath(fragmentSource));
+    if (!file.open(QFile::ReadOnly))
+    {
+        m_misses++;
+        return nullptr;
+    }
+
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint32 format = 0;
+    QByteArray binary;
+    stream >> magic >> format >> binary;
+
+    auto shader = std::make_unique<CachedShader>();
+    if (stream.status() != QDataStream::Ok || magic != CACHE_MAGIC || !shader->loadBinary(format, binary))
+    {
+        // Drivers may reject binaries even for a matching version string
+        qCDebug(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShaderCache::Load: dropping stale entry" << file.fileName();
+        file.remove();
+        m_misses++;
+        return nullptr;
+    }
+
+    m_hits++;
+    return shader;
+}
+
+void ColorTranslucencyShaderCache::Store(KWin::GLShader *shader, const QByteArray &fragmentSource)
+{
+    if (!m_supported || !m_enabled || !shader || !shader->isValid())
+        return;
+
+    GLenum format = 0;
+    QByteArray binary;
+    if (ReadBinary(programOf(shader), format, binary))
+        Write(fragmentSource, format, binary);
+}
+
+std::unique_ptr<KWin::GLShader> ColorTranslucencyShaderCache::Adopt(GLuint program, const QByteArray &fragmentSource)
+{
+    if (!m_supported)
+        return nullptr;
+
+    GLenum format = 0;
+    QByteArray binary;
+    if (!ReadBinary(program, format, binary))
+        return nullptr;
+    if (m_enabled)
+        Write(fragmentSource, format, binary);
+
+    auto shader = std::make_unique<CachedShader>();
+    if (!shader->loadBinary(format, binary))
+        return nullptr;
+    return shader;
+}
+
+bool ColorTranslucencyShaderCache::ReadBinary(GLuint program, GLenum &format, QByteArray &binary) const
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    binary = QByteArray(length, Qt::Uninitialized);
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+    return true;
+}
+
+void ColorTranslucencyShaderCache::Write(const QByteArray &fragmentSource, GLenum format, const QByteArray &binary)
+{
+    QDir().mkpath(m_directory);
+    QSaveFile file(CachePath(fragmentSource));
+    if (!file.open(QFile::WriteOnly))
+        return;
+
+    QDataStream stream(&file);
+    stream << CACHE_MAGIC << quint32(format) << binary;
+    if (!file.commit())
+        qCWarning(COLORTRANSLUCENCY_SHADERS) << "ColorTranslucencyShaderCache::Write: could not write" << file.fileName();
+}
@@ -0,0 +1,65 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <kwinglutils.h>
+#include <memory>
+#include <QByteArray>
+#include <QString>
+
+// Persistent cache of linked shader programs, stored with glGetProgramBinary
+// under ~/.cache/colortranslucency. Entries are keyed by the GL driver, the
+// KWin version and the fragment source, so a driver update or a changed
+// shader simply misses the cache. File names start with a key of the driver
+// and the embedded shaders, Initialize() deletes entries of any other key.
+class ColorTranslucencyShaderCache
+{
+public:
+    ColorTranslucencyShaderCache() = default;
+
+    // Queries the driver, needs a current GL context
+    void Initialize();
+    bool IsSupported() const { return m_supported; }
+    bool IsEnabled() const { return m_enabled; }
+    void SetEnabled(bool enabled);
+
+    // Returns nullptr on a miss, the caller then compiles and calls Store()
+    std::unique_ptr<KWin::GLShader> Load(const QByteArray &fragmentSource);
+    void Store(KWin::GLShader *shader, const QByteArray &fragmentSource);
+    // Wraps a program linked outside of KWin into a GLShader by round-tripping
+    // it through its binary, which is stored on the way. nullptr if unsupported.
+    std::unique_ptr<KWin::GLShader> Adopt(GLuint program, const QByteArray &fragmentSource);
+
+    int GetHits() const { return m_hits; }
+    int GetMisses() const { return m_misses; }
+
+private:
+    QString CachePath(const QByteArray &fragmentSource) const;
+    void Prune() const;
+    bool ReadBinary(GLuint program, GLenum &format, QByteArray &binary) const;
+    void Write(const QByteArray &fragmentSource, GLenum format, const QByteArray &binary);
+
+    bool m_supported = false;
+    bool m_enabled = true;
+    QString m_directory;
+    QByteArray m_driver;
+    // Driver and embedded shader sources, prefixes every entry
+    QString m_generation;
+    int m_hits = 0;
+    int m_misses = 0;
+};
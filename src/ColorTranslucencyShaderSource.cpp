@@ -0,0 +1,50 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "ColorTranslucencyShaderSource.h"
+
+QByteArray ColorTranslucencyShaderSource::specialize(const QByteArray &source, int numberOfColors)
+{
+    if (numberOfColors == GENERIC)
+        return source;
+
+    // First match wins, like the break in the generic loop
+    QByteArray chain;
+    for (int i = 0; i < numberOfColors; i++)
+    {
+        const QByteArray index = QByteArray::number(i);
+        if (i > 0)
+            chain += " else ";
+        chain += "if (tex.rgb == targetColor[" + index + "].rgb) tex.a = targetAlpha[" + index + "];";
+    }
+
+    QByteArray defines;
+    defines += "#define NUMBER_OF_COLORS " + QByteArray::number(numberOfColors) + "\n";
+    defines += "#define MATCH_CHAIN " + chain + "\n";
+    return define(source, defines);
+}
+
+QByteArray ColorTranslucencyShaderSource::define(const QByteArray &source, const QByteArray &defines)
+{
+    // #version has to stay the first statement of the shader
+    int insertAt = 0;
+    const int version = source.indexOf("#version");
+    if (version >= 0)
+        insertAt = source.indexOf('\n', version) + 1;
+
+    return source.left(insertAt) + defines + source.mid(insertAt);
+}
@@ -0,0 +1,35 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <QByteArray>
+
+// Source level helpers for the loop shaders. Kept free of KWin so that the
+// shader benchmark can build the exact same variants.
+namespace ColorTranslucencyShaderSource
+{
+    // Color count of the generic program, which loops over numberOfColors
+    constexpr int GENERIC = -1;
+
+    // Returns `source` with NUMBER_OF_COLORS and an unrolled MATCH_CHAIN
+    // defined, or `source` unchanged for GENERIC.
+    QByteArray specialize(const QByteArray &source, int numberOfColors);
+
+    // Returns `source` with `defines` inserted right after its #version line
+    QByteArray define(const QByteArray &source, const QByteArray &defines);
+}
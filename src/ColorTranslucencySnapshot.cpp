@@ -0,0 +1,178 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "ColorTranslucencyLogging.h"
+#include "ColorTranslucencySettings.h"
+#include "ColorTranslucencySnapshot.h"
+
+namespace
+{
+    bool parseProfile(const QString &entry, ColorTranslucencyProfile &profile)
+    {
+        // Entries look like "name | rule | #rrggbb alpha [tolerance]; ...". Names
+        // and targets never contain '|', regular expression rules may.
+        const int nameEnd = entry.indexOf('|');
+        const int targetsStart = entry.lastIndexOf('|');
+        if (nameEnd < 0 || targetsStart == nameEnd)
+            return false;
+
+        profile.name = entry.left(nameEnd).trimmed();
+        profile.rule = entry.mid(nameEnd + 1, targetsStart - nameEnd - 1).trimmed();
+        if (profile.name.isEmpty() || profile.rule.isEmpty())
+            return false;
+
+        for (const auto &target : entry.mid(targetsStart + 1).split(';', Qt::SkipEmptyParts))
+        {
+            ColorTranslucencyTarget parsed;
+            if (!ColorTranslucencySnapshot::ParseTarget(target, parsed))
+                return false;
+            profile.targets.push_back(parsed);
+        }
+        return !profile.targets.isEmpty();
+    }
+
+    std::vector<ColorTranslucencyProfile> activeProfiles(const ColorTranslucencySettings &settings)
+    {
+        std::vector<ColorTranslucencyProfile> profiles;
+        for (const auto &entry : settings.colorProfiles())
+        {
+            ColorTranslucencyProfile profile;
+            if (parseProfile(entry, profile))
+                profiles.push_back(profile);
+            else
+                qCWarning(COLORTRANSLUCENCY) << "ColorTranslucencySnapshot: ignoring malformed color profile" << entry;
+        }
+        return profiles;
+    }
+
+    ColorTranslucencyTargets activeTargets(const ColorTranslucencySettings &settings)
+    {
+        ColorTranslucencyTargets targets;
+
+        if (settings.enableColor_1())
+        {
+            targets.push_back({settings.targetColor_1(), settings.targetAlpha_1()});
+        }
+        if (settings.enableColor_2())
+        {
+            targets.push_back({settings.targetColor_2(), settings.targetAlpha_2()});
+        }
+        if (settings.enableColor_3())
+        {
+            targets.push_back({settings.targetColor_3(), settings.targetAlpha_3()});
+        }
+        if (settings.enableColor_4())
+        {
+            targets.push_back({settings.targetColor_4(), settings.targetAlpha_4()});
+        }
+        if (settings.enableColor_5())
+        {
+            targets.push_back({settings.targetColor_5(), settings.targetAlpha_5()});
+        }
+        if (settings.enableColor_6())
+        {
+            targets.push_back({settings.targetColor_6(), settings.targetAlpha_6()});
+        }
+        if (settings.enableColor_7())
+        {
+            targets.push_back({settings.targetColor_7(), settings.targetAlpha_7()});
+        }
+        if (settings.enableColor_8())
+        {
+            targets.push_back({settings.targetColor_8(), settings.targetAlpha_8()});
+        }
+        if (settings.enableColor_9())
+        {
+            targets.push_back({settings.targetColor_9(), settings.targetAlpha_9()});
+        }
+        if (settings.enableColor_10())
+        {
+            targets.push_back({settings.targetColor_10(), settings.targetAlpha_10()});
+        }
+
+        for (const auto &entry : settings.extraTargetColors())
+        {
+            ColorTranslucencyTarget target;
+            if (ColorTranslucencySnapshot::ParseTarget(entry, target))
+                targets.push_back(target);
+            else
+                qCWarning(COLORTRANSLUCENCY) << "ColorTranslucencySnapshot: ignoring malformed extra target color" << entry;
+        }
+
+        return targets;
+    }
+}
+
+bool ColorTranslucencySnapshot::ParseTarget(const QString &entry, ColorTranslucencyTarget &target)
+{
+    // Entries look like "#rrggbb alpha [tolerance]"
+    const QStringList parts = entry.split(' ', Qt::SkipEmptyParts);
+    if (parts.size() < 2 || parts.size() > 3)
+        return false;
+
+    bool alphaOk = false;
+    bool toleranceOk = true;
+    target.color = QColor(parts[0]);
+    target.alpha = parts[1].toInt(&alphaOk);
+    target.tolerance = parts.size() == 3 ? parts[2].toInt(&toleranceOk) : 0;
+    // Both are 8-bit values, a tolerance of 255 already covers the whole cube
+    return target.color.isValid() && alphaOk && toleranceOk && target.alpha >= 0 && target.alpha <= 255 &&
+           target.tolerance >= 0 && target.tolerance <= 255;
+}
+
+std::shared_ptr<const ColorTranslucencySnapshot> ColorTranslucencySnapshot::Load()
+{
+    ColorTranslucencySettings settings;
+    settings.load();
+
+    auto snapshot = std::make_shared<ColorTranslucencySnapshot>();
+    snapshot->targets = activeTargets(settings);
+    snapshot->profiles = activeProfiles(settings);
+    snapshot->colorSets.push_back(snapshot->targets);
+    for (const auto &profile : snapshot->profiles)
+    {
+        snapshot->colorSets.push_back(profile.targets);
+        snapshot->profileRules.push_back(profile.rule);
+    }
+    snapshot->lookupTexture = settings.lookupTextureMatching();
+    snapshot->specialize = settings.specializedShaders();
+    snapshot->inclusions = settings.inclusionList();
+    snapshot->exclusions = settings.exclusionList();
+    snapshot->rules.Compile(snapshot->inclusions, snapshot->exclusions);
+    snapshot->matchCaptions = snapshot->rules.UsesTitle();
+    for (const auto &profile : snapshot->profiles)
+    {
+        snapshot->profileMatchers.emplace_back();
+        snapshot->profileMatchers.back().Compile({profile.rule}, {});
+        snapshot->matchCaptions |= snapshot->profileMatchers.back().UsesTitle();
+    }
+
+    snapshot->contentProbing = settings.contentProbing();
+    snapshot->probeInterval = settings.contentProbeInterval();
+    snapshot->tileOpaqueRegions = settings.tileOpaqueRegions();
+    snapshot->suspendHidden = settings.suspendHiddenWindows();
+    snapshot->evictionDelay = settings.offscreenEvictionDelay() * 1000;
+    snapshot->bypassFullscreen = settings.bypassFullscreen();
+    snapshot->bypassMaximized = settings.bypassMaximized();
+    snapshot->frameBudget = settings.frameTimeBudget();
+    snapshot->governorWindowLimit = settings.governorWindowLimit();
+
+    snapshot->deferredInitialization = settings.deferredInitialization();
+    snapshot->liveShaderReload = settings.liveShaderReload();
+    snapshot->shaderBinaryCache = settings.shaderBinaryCache();
+    return snapshot;
+}
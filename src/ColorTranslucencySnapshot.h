@@ -0,0 +1,68 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <QStringList>
+#include "ColorTranslucencyRules.h"
+#include "ColorTranslucencyTarget.h"
+
+// Everything the effect takes from its configuration, parsed in one go and
+// never modified once published. Load() only touches its own KConfig, so it
+// runs on a worker thread while the compositor keeps drawing with the
+// previous snapshot.
+struct ColorTranslucencySnapshot
+{
+    ColorTranslucencyTargets targets;
+    std::vector<ColorTranslucencyProfile> profiles;
+    // The global targets followed by the targets of every profile, in the
+    // order the shader manager packs them
+    QVector<ColorTranslucencyTargets> colorSets;
+    QStringList profileRules;
+    bool lookupTexture = false;
+    bool specialize = false;
+    QStringList inclusions;
+    QStringList exclusions;
+    // Compiled from the lists above, and one matcher per profile
+    ColorTranslucencyRules rules;
+    std::vector<ColorTranslucencyRules> profileMatchers;
+    // Whether any rule looks at captions
+    bool matchCaptions = false;
+
+    bool contentProbing = false;
+    int probeInterval = 500;
+    bool tileOpaqueRegions = false;
+    bool suspendHidden = false;
+    // In ms
+    int evictionDelay = 0;
+    bool bypassFullscreen = false;
+    bool bypassMaximized = false;
+    int frameBudget = 0;
+    int governorWindowLimit = 3;
+
+    bool deferredInitialization = false;
+    bool liveShaderReload = false;
+    bool shaderBinaryCache = false;
+
+    // Parses "#rrggbb alpha [tolerance]" as used by ExtraTargetColors, alpha
+    // and tolerance are 0-255; out of range entries are rejected
+    static bool ParseTarget(const QString &entry, ColorTranslucencyTarget &target);
+    // Reads kwinrc through a KConfig of the calling thread
+    static std::shared_ptr<const ColorTranslucencySnapshot> Load();
+};
@@ -0,0 +1,86 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <algorithm>
+#include <QVariantList>
+#include "ColorTranslucencyStats.h"
+
+void ColorTranslucencyHistogram::Add(qint64 nanoseconds)
+{
+    const qint64 microseconds = std::max<qint64>(0, nanoseconds / 1000);
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && microseconds >= (qint64(1) << bucket))
+        bucket++;
+    m_buckets[bucket]++;
+    m_count++;
+    m_sum += nanoseconds;
+    m_max = std::max(m_max, nanoseconds);
+}
+
+QVariantMap ColorTranslucencyHistogram::ToVariant() const
+{
+    QVariantList buckets;
+    QVariantList bounds;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        buckets.push_back(m_buckets[i]);
+        // Exclusive upper bound in µs, -1 for the open last bucket
+        bounds.push_back(i < BUCKETS - 1 ? qint64(1) << i : qint64(-1));
+    }
+    return {
+        {QStringLiteral("buckets"), buckets},
+        {QStringLiteral("boundsUs"), bounds},
+        {QStringLiteral("count"), m_count},
+        {QStringLiteral("sumUs"), m_sum / 1000},
+        {QStringLiteral("maxUs"), m_max / 1000},
+    };
+}
+
+void ColorTranslucencyFrameStats::AddGpuTime(const void *output, quint64 frame, qint64 nanoseconds)
+{
+    // Results come in submission order, a new frame closes the previous one.
+    // Outputs count their frames separately.
+    if ((frame != m_gpuFrame || output != m_gpuOutput) && m_gpuFrameTime > 0)
+    {
+        m_gpu.Add(m_gpuFrameTime);
+        m_gpuFrameTime = 0;
+    }
+    m_gpuOutput = output;
+    m_gpuFrame = frame;
+    m_gpuFrameTime += nanoseconds;
+}
+
+void ColorTranslucencyFrameStats::EndFrame(int keyedWindows)
+{
+    // Frames without managed windows say nothing about the effect
+    if (m_frameCpu > 0)
+        m_cpu.Add(m_frameCpu);
+    if (keyedWindows > 0)
+        m_keyedFrames++;
+    m_frameCpu = 0;
+    m_frames++;
+}
+
+QVariantMap ColorTranslucencyFrameStats::ToVariant() const
+{
+    return {
+        {QStringLiteral("frames"), m_frames},
+        {QStringLiteral("keyedFrames"), m_keyedFrames},
+        {QStringLiteral("cpu"), m_cpu.ToVariant()},
+        {QStringLiteral("gpu"), m_gpu.ToVariant()},
+    };
+}
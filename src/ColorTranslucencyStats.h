@@ -0,0 +1,91 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <array>
+#include <QElapsedTimer>
+#include <QVariantMap>
+
+// Counts of durations in power of two buckets of microseconds: bucket 0 holds
+// everything below 1 µs, bucket i everything below 2^i µs, the last one the rest.
+class ColorTranslucencyHistogram
+{
+public:
+    static constexpr int BUCKETS = 16;
+
+    void Add(qint64 nanoseconds);
+    QVariantMap ToVariant() const;
+
+private:
+    std::array<quint64, BUCKETS> m_buckets{};
+    quint64 m_count = 0;
+    qint64 m_sum = 0;
+    qint64 m_max = 0;
+};
+
+// What the effect costs per painted frame. CPU time is added while the frame
+// is painted, GPU time arrives frames later tagged with the output and frame
+// it belongs to.
+class ColorTranslucencyFrameStats
+{
+public:
+    void AddCpuTime(qint64 nanoseconds) { m_frameCpu += nanoseconds; }
+    void AddGpuTime(const void *output, quint64 frame, qint64 nanoseconds);
+    void EndFrame(int keyedWindows);
+    void Reset() { *this = ColorTranslucencyFrameStats(); }
+
+    quint64 GetFrame() const { return m_frames; }
+    QVariantMap ToVariant() const;
+
+private:
+    quint64 m_frames = 0;
+    qint64 m_frameCpu = 0;
+    const void *m_gpuOutput = nullptr;
+    quint64 m_gpuFrame = 0;
+    qint64 m_gpuFrameTime = 0;
+    quint64 m_keyedFrames = 0;
+    ColorTranslucencyHistogram m_cpu;
+    ColorTranslucencyHistogram m_gpu;
+};
+
+// Adds the time until the end of the scope to a window and a frame total, in
+// ns. Costs two clock reads, and nothing without a window to account it to.
+class ColorTranslucencyScopedTimer
+{
+public:
+    ColorTranslucencyScopedTimer(const QElapsedTimer &clock, qint64 *window, ColorTranslucencyFrameStats &frame)
+        : m_clock(clock), m_window(window), m_frame(frame), m_start(window ? clock.nsecsElapsed() : 0)
+    {
+    }
+    ~ColorTranslucencyScopedTimer()
+    {
+        if (!m_window)
+            return;
+        const qint64 elapsed = m_clock.nsecsElapsed() - m_start;
+        *m_window += elapsed;
+        m_frame.AddCpuTime(elapsed);
+    }
+    ColorTranslucencyScopedTimer(const ColorTranslucencyScopedTimer &) = delete;
+    ColorTranslucencyScopedTimer &operator=(const ColorTranslucencyScopedTimer &) = delete;
+
+private:
+    const QElapsedTimer &m_clock;
+    qint64 *m_window;
+    ColorTranslucencyFrameStats &m_frame;
+    qint64 m_start;
+};
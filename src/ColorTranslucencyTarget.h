@@ -0,0 +1,49 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <QColor>
+#include <QString>
+#include <QVector>
+
+// A single configured color key: pixels of `color` get the alpha `alpha`.
+// `tolerance` is a radius in 8-bit RGB units, only honored by the lookup
+// texture matcher; 0 means an exact match.
+struct ColorTranslucencyTarget
+{
+    QColor color;
+    int alpha = 0;
+    int tolerance = 0;
+
+    bool operator==(const ColorTranslucencyTarget &other) const
+    {
+        return color == other.color && alpha == other.alpha && tolerance == other.tolerance;
+    }
+    bool operator!=(const ColorTranslucencyTarget &other) const { return !(*this == other); }
+};
+
+using ColorTranslucencyTargets = QVector<ColorTranslucencyTarget>;
+
+// Targets used instead of the global ones for the windows `rule` matches,
+// see ColorTranslucencyRules for the rule syntax.
+struct ColorTranslucencyProfile
+{
+    QString name;
+    QString rule;
+    ColorTranslucencyTargets targets;
+};
@@ -0,0 +1,96 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <algorithm>
+#include "ColorTranslucencyLogging.h"
+#include "ColorTranslucencyTexturePool.h"
+
+namespace
+{
+    // Smallest size class edge, keeps tiny windows from creating many classes
+    constexpr int MIN_EDGE = 64;
+
+    int roundUp(int edge)
+    {
+        int rounded = MIN_EDGE;
+        while (rounded < edge)
+            rounded *= 2;
+        return rounded;
+    }
+}
+
+ColorTranslucencyTexturePool::ColorTranslucencyTexturePool()
+{
+    m_clock.start();
+}
+
+ColorTranslucencyTexturePool::~ColorTranslucencyTexturePool()
+{
+    for (const auto &idle : m_idle)
+        glDeleteTextures(1, &idle.texture.id);
+}
+
+QSize ColorTranslucencyTexturePool::SizeClass(const QSize &size)
+{
+    return QSize(roundUp(size.width()), roundUp(size.height()));
+}
+
+ColorTranslucencyTexturePool::Texture ColorTranslucencyTexturePool::Acquire(const QSize &size)
+{
+    const QSize sizeClass = SizeClass(size);
+    const auto it = std::find_if(m_idle.begin(), m_idle.end(), [&sizeClass](const Idle &idle) { return idle.texture.size == sizeClass; });
+    if (it != m_idle.end())
+    {
+        const Texture texture = it->texture;
+        m_idle.erase(it);
+        return texture;
+    }
+
+    Texture texture;
+    texture.size = sizeClass;
+    glGenTextures(1, &texture.id);
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, sizeClass.width(), sizeClass.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_count++;
+    m_bytes += BytesOf(sizeClass);
+    m_peakBytes = std::max(m_peakBytes, m_bytes);
+    qCDebugLimited(COLORTRANSLUCENCY_LIFECYCLE) << "ColorTranslucencyTexturePool::Acquire: new" << sizeClass << "texture," << m_bytes << "bytes in" << m_count << "textures";
+    return texture;
+}
+
+void ColorTranslucencyTexturePool::Release(const Texture &texture)
+{
+    if (texture.id)
+        m_idle.push_back({texture, m_clock.elapsed()});
+}
+
+void ColorTranslucencyTexturePool::Trim(qint64 maxIdle)
+{
+    const qint64 now = m_clock.elapsed();
+    const auto expired = std::partition(m_idle.begin(), m_idle.end(), [now, maxIdle](const Idle &idle) { return now - idle.since <= maxIdle; });
+    for (auto it = expired; it != m_idle.end(); ++it)
+    {
+        glDeleteTextures(1, &it->texture.id);
+        m_count--;
+        m_bytes -= BytesOf(it->texture.size);
+    }
+    m_idle.erase(expired, m_idle.end());
+}
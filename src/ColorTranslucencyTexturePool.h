@@ -0,0 +1,68 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <epoxy/gl.h>
+#include <vector>
+#include <QElapsedTimer>
+#include <QSize>
+
+// RGBA8 textures for the effect's own render targets, handed out in power of
+// two size classes so windows of similar size share them. Released textures
+// stay around for reuse until Trim() finds them idle for too long.
+class ColorTranslucencyTexturePool
+{
+public:
+    struct Texture
+    {
+        GLuint id = 0;
+        QSize size;
+    };
+
+    ColorTranslucencyTexturePool();
+    ~ColorTranslucencyTexturePool();
+    ColorTranslucencyTexturePool(const ColorTranslucencyTexturePool &) = delete;
+    ColorTranslucencyTexturePool &operator=(const ColorTranslucencyTexturePool &) = delete;
+
+    // Returns a texture at least `size` large, needs a current GL context
+    Texture Acquire(const QSize &size);
+    void Release(const Texture &texture);
+    // Deletes released textures unused for longer than `maxIdle` ms
+    void Trim(qint64 maxIdle);
+
+    // Bytes of all textures, in use or idle
+    quint64 GetBytes() const { return m_bytes; }
+    quint64 GetPeakBytes() const { return m_peakBytes; }
+    int GetCount() const { return m_count; }
+
+private:
+    struct Idle
+    {
+        Texture texture;
+        qint64 since = 0;
+    };
+
+    static QSize SizeClass(const QSize &size);
+    static quint64 BytesOf(const QSize &size) { return 4ull * size.width() * size.height(); }
+
+    QElapsedTimer m_clock;
+    std::vector<Idle> m_idle;
+    quint64 m_bytes = 0;
+    quint64 m_peakBytes = 0;
+    int m_count = 0;
+};
@@ -0,0 +1,173 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <kwinglplatform.h>
+#include <kwinglutils.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "ColorTranslucencyTileMask.h"
+
+ColorTranslucencyTileMask::~ColorTranslucencyTileMask()
+{
+    if (m_fence)
+        glDeleteSync(m_fence);
+    if (m_framebuffer)
+        glDeleteFramebuffers(1, &m_framebuffer);
+    if (m_buffer)
+        glDeleteBuffers(1, &m_buffer);
+}
+
+bool ColorTranslucencyTileMask::IsSupported()
+{
+    return KWin::GLPlatform::instance()->isGLES() ? KWin::hasGLVersion(3, 0) : KWin::hasGLVersion(3, 2);
+}
+
+bool ColorTranslucencyTileMask::Begin(const QSize &size, const QRect &dirtyTiles, qreal deviceScale, QMatrix4x4 &projection)
+{
+    if (IsBusy() || size.isEmpty())
+        return false;
+
+    m_size = QSize(int(std::ceil(size.width() * deviceScale)), int(std::ceil(size.height() * deviceScale)));
+    m_tileSize = TILE_SIZE * deviceScale;
+    // Rounded outwards, a pixel shared by two tiles counts for both
+    const QPoint topLeft(int(std::floor(dirtyTiles.x() * m_tileSize)), int(std::floor(dirtyTiles.y() * m_tileSize)));
+    const QPoint bottomRight(int(std::ceil((dirtyTiles.x() + dirtyTiles.width()) * m_tileSize)) - 1,
+                             int(std::ceil((dirtyTiles.y() + dirtyTiles.height()) * m_tileSize)) - 1);
+    m_dirtyPixels = QRect(topLeft, bottomRight) & QRect(QPoint(0, 0), m_size);
+    if (m_dirtyPixels.isEmpty())
+        return false;
+    m_dirtyTiles = dirtyTiles;
+    if (!m_framebuffer)
+    {
+        glGenFramebuffers(1, &m_framebuffer);
+        glGenBuffers(1, &m_buffer);
+    }
+
+    // Grown only, the readback never needs more than the largest mask so far
+    if (m_bufferSize.width() < m_size.width() || m_bufferSize.height() < m_size.height())
+    {
+        m_bufferSize = m_bufferSize.expandedTo(m_size);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4 * m_bufferSize.width() * m_bufferSize.height(), nullptr, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // Smaller masks use the top left corner of their size class
+    m_texture = m_pool.Acquire(m_size);
+
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, m_previousViewport);
+    glGetIntegerv(GL_SCISSOR_BOX, m_previousScissorBox);
+    m_previousScissor = glIsEnabled(GL_SCISSOR_TEST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture.id, 0);
+    glViewport(0, 0, m_size.width(), m_size.height());
+    // The mask is stored bottom up, the clear and the draw only touch the damage
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(m_dirtyPixels.x(), m_size.height() - m_dirtyPixels.y() - m_dirtyPixels.height(),
+              m_dirtyPixels.width(), m_dirtyPixels.height());
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    projection.setToIdentity();
+    projection.ortho(0, size.width() * deviceScale, size.height() * deviceScale, 0, -1, 1);
+    return true;
+}
+
+void ColorTranslucencyTileMask::End()
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffer);
+    glReadPixels(m_dirtyPixels.x(), m_size.height() - m_dirtyPixels.y() - m_dirtyPixels.height(),
+                 m_dirtyPixels.width(), m_dirtyPixels.height(), GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // The copy is queued, GL keeps the texture alive until it is done
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    m_pool.Release(m_texture);
+    m_texture = {};
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_previousFramebuffer);
+    glViewport(m_previousViewport[0], m_previousViewport[1], m_previousViewport[2], m_previousViewport[3]);
+    glScissor(m_previousScissorBox[0], m_previousScissorBox[1], m_previousScissorBox[2], m_previousScissorBox[3]);
+    if (!m_previousScissor)
+        glDisable(GL_SCISSOR_TEST);
+}
+
+bool ColorTranslucencyTileMask::Read(QRect &dirtyTiles, QBitArray &tiles)
+{
+    if (!m_fence)
+        return false;
+
+    const GLenum status = glClientWaitSync(m_fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+    glDeleteSync(m_fence);
+    m_fence = nullptr;
+
+    const int width = m_dirtyPixels.width();
+    const int height = m_dirtyPixels.height();
+    dirtyTiles = m_dirtyTiles;
+    tiles = QBitArray(dirtyTiles.width() * dirtyTiles.height());
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffer);
+    const auto pixels = static_cast<const uchar *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4 * width * height, GL_MAP_READ_BIT));
+    if (pixels)
+    {
+        // Column span of every dirty tile in buffer pixels
+        std::vector<std::pair<int, int>> columns(dirtyTiles.width());
+        for (int tile = 0; tile < dirtyTiles.width(); tile++)
+        {
+            const int first = int(std::floor((dirtyTiles.x() + tile) * m_tileSize)) - m_dirtyPixels.x();
+            const int last = int(std::ceil((dirtyTiles.x() + tile + 1) * m_tileSize)) - m_dirtyPixels.x();
+            columns[tile] = {std::max(first, 0), std::min(last, width)};
+        }
+
+        // Rows come bottom up, the probe shader writes 1.0 where a target
+        // matched. A tile stops being scanned once one texel matched.
+        for (int y = 0; y < height; y++)
+        {
+            const uchar *row = pixels + 4 * width * y;
+            // At fractional scales a pixel row can straddle two tile rows
+            const int pixel = m_dirtyPixels.bottom() - y;
+            const int firstRow = std::max(int(std::floor(pixel / m_tileSize)) - dirtyTiles.y(), 0);
+            const int lastRow = std::min(int(std::ceil((pixel + 1) / m_tileSize)) - 1 - dirtyTiles.y(), dirtyTiles.height() - 1);
+            for (int tileRow = firstRow; tileRow <= lastRow; tileRow++)
+            {
+                for (int tile = 0; tile < dirtyTiles.width(); tile++)
+                {
+                    const int bit = tileRow * dirtyTiles.width() + tile;
+                    if (tiles.testBit(bit))
+                        continue;
+                    for (int x = columns[tile].first; x < columns[tile].second; x++)
+                    {
+                        if (row[4 * x])
+                        {
+                            tiles.setBit(bit);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return pixels != nullptr;
+}
@@ -0,0 +1,77 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <epoxy/gl.h>
+#include <QBitArray>
+#include <QMatrix4x4>
+#include <QRect>
+#include <QSize>
+#include "ColorTranslucencyTexturePool.h"
+
+// Per tile record of which parts of a window show a target color.
+//
+// The window is drawn through the probe shader into a mask texture at its
+// full device resolution, which is copied into a pixel buffer and reduced to
+// one bit per tile once a fence says the copy is done. A tile is keyed as soon
+// as any of its texels matched, so thin text or borders are never missed.
+// Only the damaged tiles are drawn and read back. Only one mask is in flight
+// at a time.
+class ColorTranslucencyTileMask
+{
+public:
+    // Tile edge in logical pixels
+    static constexpr int TILE_SIZE = 32;
+
+    explicit ColorTranslucencyTileMask(ColorTranslucencyTexturePool &pool) : m_pool(pool) {}
+    ~ColorTranslucencyTileMask();
+    ColorTranslucencyTileMask(const ColorTranslucencyTileMask &) = delete;
+    ColorTranslucencyTileMask &operator=(const ColorTranslucencyTileMask &) = delete;
+
+    // Needs pixel buffers and fences, GL 3.2 or GLES 3.0
+    static bool IsSupported();
+    bool IsBusy() const { return m_fence != nullptr; }
+
+    // Redirects drawing into the mask for an area of `size` logical pixels,
+    // clipped to and clearing `dirtyTiles` (in tiles). `projection` maps that
+    // area, in render target pixels at `deviceScale`, onto the mask 1:1.
+    bool Begin(const QSize &size, const QRect &dirtyTiles, qreal deviceScale, QMatrix4x4 &projection);
+    // Restores the previous render target and queues the readback
+    void End();
+    // Fills one bit per tile of `dirtyTiles`, row major; false while the
+    // readback is in flight
+    bool Read(QRect &dirtyTiles, QBitArray &tiles);
+
+private:
+    ColorTranslucencyTexturePool &m_pool;
+    ColorTranslucencyTexturePool::Texture m_texture;
+    GLuint m_framebuffer = 0;
+    GLuint m_buffer = 0;
+    QSize m_bufferSize;
+    QSize m_size;
+    // Tile edge in mask pixels
+    qreal m_tileSize = TILE_SIZE;
+    QRect m_dirtyTiles;
+    QRect m_dirtyPixels;
+    GLsync m_fence = nullptr;
+
+    GLint m_previousFramebuffer = 0;
+    GLint m_previousViewport[4] = {};
+    GLint m_previousScissorBox[4] = {};
+    GLboolean m_previousScissor = GL_FALSE;
+};
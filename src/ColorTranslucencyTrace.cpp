@@ -0,0 +1,198 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <algorithm>
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include "ColorTranslucencyLogging.h"
+#include "ColorTranslucencyTrace.h"
+
+namespace
+{
+    // Small ids read better in trace viewers than native thread handles
+    std::atomic<quint32> s_nextThread{0};
+    quint32 currentThread()
+    {
+        thread_local const quint32 id = s_nextThread.fetch_add(1, std::memory_order_relaxed) + 1;
+        return id;
+    }
+
+    QJsonObject metadata(const char *name, quint32 thread, const QString &value)
+    {
+        return {
+            {QStringLiteral("name"), QLatin1String(name)},
+            {QStringLiteral("ph"), QStringLiteral("M")},
+            {QStringLiteral("pid"), QCoreApplication::applicationPid()},
+            {QStringLiteral("tid"), qint64(thread)},
+            {QStringLiteral("args"), QJsonObject{{QStringLiteral("name"), value}}},
+        };
+    }
+}
+
+ColorTranslucencyTrace &ColorTranslucencyTrace::Global()
+{
+    static ColorTranslucencyTrace trace;
+    return trace;
+}
+
+ColorTranslucencyTrace::ColorTranslucencyTrace()
+{
+    m_clock.start();
+}
+
+ColorTranslucencyTrace::~ColorTranslucencyTrace()
+{
+    delete[] m_slots.load(std::memory_order_relaxed);
+}
+
+void ColorTranslucencyTrace::Start()
+{
+    if (IsEnabled())
+        return;
+
+    if (!m_slots.load(std::memory_order_relaxed))
+        m_slots.store(new Slot[CAPACITY], std::memory_order_release);
+    {
+        QMutexLocker locker(&m_namesMutex);
+        m_names.clear();
+    }
+    m_first.store(m_next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_recordingThread.store(currentThread(), std::memory_order_relaxed);
+    // Publishes the ring to writers on other threads
+    m_enabled.store(true, std::memory_order_release);
+    qCDebug(COLORTRANSLUCENCY) << "ColorTranslucencyTrace::Start: recording up to" << CAPACITY << "spans";
+}
+
+void ColorTranslucencyTrace::Stop()
+{
+    m_enabled.store(false, std::memory_order_relaxed);
+}
+
+void ColorTranslucencyTrace::Record(const char *name, qint64 start, qint64 end, quint32 window, const QRect &geometry)
+{
+    if (!m_enabled.load(std::memory_order_acquire))
+        return;
+
+    const quint64 index = m_next.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = m_slots.load(std::memory_order_relaxed)[index % CAPACITY];
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(end - start, std::memory_order_relaxed);
+    slot.thread.store(currentThread(), std::memory_order_relaxed);
+    slot.window.store(window, std::memory_order_relaxed);
+    slot.geometry[0].store(geometry.x(), std::memory_order_relaxed);
+    slot.geometry[1].store(geometry.y(), std::memory_order_relaxed);
+    slot.geometry[2].store(geometry.width(), std::memory_order_relaxed);
+    slot.geometry[3].store(geometry.height(), std::memory_order_relaxed);
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+void ColorTranslucencyTrace::NameWindow(quint32 window, const QString &windowClass)
+{
+    QMutexLocker locker(&m_namesMutex);
+    m_names.insert(window, windowClass);
+}
+
+quint64 ColorTranslucencyTrace::GetRecorded() const
+{
+    return m_next.load(std::memory_order_relaxed) - m_first.load(std::memory_order_relaxed);
+}
+
+bool ColorTranslucencyTrace::Write(const QString &path) const
+{
+    QJsonArray events;
+    const qint64 pid = QCoreApplication::applicationPid();
+    events.push_back(metadata("process_name", 0, QStringLiteral("kwin colortranslucency")));
+    // Start() may run again on the compositor thread while this writes
+    const quint64 recordingFirst = m_first.load(std::memory_order_relaxed);
+    events.push_back(metadata("thread_name", m_recordingThread.load(std::memory_order_relaxed), QStringLiteral("compositor")));
+
+    QHash<quint32, QString> names;
+    {
+        QMutexLocker locker(&m_namesMutex);
+        names = m_names;
+    }
+
+    const quint64 next = std::max(m_next.load(std::memory_order_acquire), recordingFirst);
+    const quint64 first = std::max(recordingFirst, next > CAPACITY ? next - CAPACITY : 0);
+    const Slot *slots = m_slots.load(std::memory_order_acquire);
+    quint64 torn = 0;
+    for (quint64 index = first; slots && index < next; index++)
+    {
+        const Slot &slot = slots[index % CAPACITY];
+        const quint64 sequence = slot.sequence.load(std::memory_order_acquire);
+        const char *name = slot.name.load(std::memory_order_relaxed);
+        const qint64 start = slot.start.load(std::memory_order_relaxed);
+        const qint64 duration = slot.duration.load(std::memory_order_relaxed);
+        const quint32 thread = slot.thread.load(std::memory_order_relaxed);
+        const quint32 window = slot.window.load(std::memory_order_relaxed);
+        const QRect geometry(slot.geometry[0].load(std::memory_order_relaxed), slot.geometry[1].load(std::memory_order_relaxed),
+                             slot.geometry[2].load(std::memory_order_relaxed), slot.geometry[3].load(std::memory_order_relaxed));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // Still being written, or overwritten while it was read
+        if (sequence != 2 * index + 2 || slot.sequence.load(std::memory_order_relaxed) != sequence)
+        {
+            torn++;
+            continue;
+        }
+
+        QJsonObject event{
+            {QStringLiteral("name"), QLatin1String(name)},
+            {QStringLiteral("cat"), QStringLiteral("colortranslucency")},
+            {QStringLiteral("ph"), QStringLiteral("X")},
+            {QStringLiteral("ts"), start / 1000.0},
+            {QStringLiteral("dur"), duration / 1000.0},
+            {QStringLiteral("pid"), pid},
+            {QStringLiteral("tid"), qint64(thread)},
+        };
+        if (window)
+        {
+            event.insert(QStringLiteral("args"), QJsonObject{
+                {QStringLiteral("window"), qint64(window)},
+                {QStringLiteral("class"), names.value(window)},
+                {QStringLiteral("geometry"), QStringLiteral("%1,%2 %3x%4").arg(geometry.x()).arg(geometry.y())
+                                                 .arg(geometry.width()).arg(geometry.height())},
+            });
+        }
+        events.push_back(event);
+    }
+
+    const QJsonObject trace{
+        {QStringLiteral("traceEvents"), events},
+        {QStringLiteral("displayTimeUnit"), QStringLiteral("ns")},
+        {QStringLiteral("otherData"), QJsonObject{
+            {QStringLiteral("recorded"), qint64(next - recordingFirst)},
+            {QStringLiteral("overwritten"), qint64(first - recordingFirst)},
+            {QStringLiteral("skipped"), qint64(torn)},
+        }},
+    };
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact)) < 0 || !file.commit())
+    {
+        qCWarning(COLORTRANSLUCENCY) << "ColorTranslucencyTrace::Write: could not write" << path << file.errorString();
+        return false;
+    }
+    qCDebug(COLORTRANSLUCENCY) << "ColorTranslucencyTrace::Write:" << events.size() << "events to" << path;
+    return true;
+}
@@ -0,0 +1,126 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QRect>
+#include <QString>
+
+// Opt-in span recorder for the render path, dumped as Chrome trace event
+// JSON, which Perfetto and chrome://tracing both open. Spans go into a fixed
+// ring that overwrites the oldest ones; writers never block, a slot is
+// guarded by a sequence number so a dump skips slots that are being written.
+// Spans can come from any thread, windows are named separately because their
+// class is only known when they are matched.
+class ColorTranslucencyTrace
+{
+public:
+    static constexpr quint64 CAPACITY = 1 << 14;
+
+    static ColorTranslucencyTrace &Global();
+
+    bool IsEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    // Drops what was recorded before, allocates the ring on first use
+    void Start();
+    // Keeps the recorded spans for Write()
+    void Stop();
+
+    qint64 Now() const { return m_clock.nsecsElapsed(); }
+    void Record(const char *name, qint64 start, qint64 end, quint32 window, const QRect &geometry);
+
+    // Window ids are never reused, unlike window pointers
+    quint32 NewWindowId() { return m_nextWindow.fetch_add(1, std::memory_order_relaxed) + 1; }
+    void NameWindow(quint32 window, const QString &windowClass);
+
+    // Returns false if the file could not be written
+    bool Write(const QString &path) const;
+    quint64 GetRecorded() const;
+
+private:
+    struct Slot
+    {
+        // 2 * index + 1 while being written, 2 * index + 2 once complete
+        std::atomic<quint64> sequence{0};
+        std::atomic<const char *> name{nullptr};
+        std::atomic<qint64> start{0};
+        std::atomic<qint64> duration{0};
+        std::atomic<quint32> thread{0};
+        std::atomic<quint32> window{0};
+        std::array<std::atomic<int>, 4> geometry{};
+    };
+
+    ColorTranslucencyTrace();
+    ~ColorTranslucencyTrace();
+
+    QElapsedTimer m_clock;
+    std::atomic<bool> m_enabled{false};
+    // Set once by the first Start(), Write() may read it on another thread
+    std::atomic<Slot *> m_slots{nullptr};
+    std::atomic<quint64> m_next{0};
+    // Index of the first span of the current recording
+    std::atomic<quint64> m_first{0};
+    std::atomic<quint32> m_recordingThread{0};
+    std::atomic<quint32> m_nextWindow{0};
+
+    mutable QMutex m_namesMutex;
+    QHash<quint32, QString> m_names;
+};
+
+// Records the time until the end of the scope as a span when tracing is on,
+// otherwise costs a relaxed load. `name` has to outlive the trace.
+class ColorTranslucencyTraceSpan
+{
+public:
+    explicit ColorTranslucencyTraceSpan(const char *name)
+    {
+        ColorTranslucencyTrace &trace = ColorTranslucencyTrace::Global();
+        if (trace.IsEnabled())
+        {
+            m_name = name;
+            m_start = trace.Now();
+        }
+    }
+    ~ColorTranslucencyTraceSpan()
+    {
+        if (m_name)
+        {
+            ColorTranslucencyTrace &trace = ColorTranslucencyTrace::Global();
+            trace.Record(m_name, m_start, trace.Now(), m_window, m_geometry);
+        }
+    }
+    ColorTranslucencyTraceSpan(const ColorTranslucencyTraceSpan &) = delete;
+    ColorTranslucencyTraceSpan &operator=(const ColorTranslucencyTraceSpan &) = delete;
+
+    // Only worth computing arguments for while active
+    bool IsActive() const { return m_name; }
+    void SetWindow(quint32 window, const QRect &geometry)
+    {
+        m_window = window;
+        m_geometry = geometry;
+    }
+
+private:
+    const char *m_name = nullptr;
+    qint64 m_start = 0;
+    quint32 m_window = 0;
+    QRect m_geometry;
+};
@@ -0,0 +1,115 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ *
+ * This file is part of Color Translucency Effect.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <epoxy/gl.h>
+#include <QRegion>
+#include <QString>
+
+// Why the offscreen state of a window is released, see
+// ColorTranslucencyEffect::updateVisibility. Any reason suspends the window.
+enum ColorTranslucencySuspendReason
+{
+    SuspendMinimized = 1 << 0,
+    SuspendOtherDesktop = 1 << 1,
+    SuspendOtherActivity = 1 << 2,
+    SuspendOccluded = 1 << 3,
+    SuspendIdle = 1 << 4,
+};
+
+// Per-window state kept by the effect for every window it knows about.
+// Everything in here is derived from the window and the configuration and is
+// only recomputed when one of them changes, never on the paint path.
+struct ColorTranslucencyWindow
+{
+    // Names the window in D-Bus records and ColorTranslucencyTrace spans,
+    // assigned once and never reused.
+    quint32 id = 0;
+    // Raw class as reported by KWin, used to detect class changes.
+    QString windowClass;
+    // Normalized title as shown in the KCM and matched against the lists.
+    QString title;
+    // Caption the rules were last evaluated with, only kept when a rule needs it.
+    QString caption;
+    // Class and caption changes are signalled, otherwise damage checks for them
+    bool matchSignals = false;
+    // Result of matching the window against ColorTranslucencyRules, and the
+    // rule that decided it or -1.
+    bool included = false;
+    int rule = -1;
+    // Color profile the window is keyed with, 0 for the global targets.
+    int profile = 0;
+    // Smallest scale the window was last drawn at, and whether that counts as
+    // a thumbnail (overview, Alt+Tab) with some hysteresis against flapping.
+    double paintScale = 1.0;
+    bool scaledDown = false;
+    quint64 scaledFrames = 0;
+    // Fullscreen (or maximized) and left alone so KWin can scan it out directly.
+    bool bypassed = false;
+    // Left unkeyed by the frame-time governor, see ColorTranslucencyGovernor.
+    bool throttled = false;
+    // Whether the color key is applied.
+    bool keyed = false;
+    // Whether the window is currently redirected into an offscreen texture.
+    bool redirected = false;
+
+    // Content probe, see ColorTranslucencyProbe.
+    // Query in flight, 0 if none.
+    GLuint probeQuery = 0;
+    // Damaged since the last probe was drawn.
+    bool probePending = true;
+    // The last probe found no target color, KWin draws the window as is.
+    bool probeEmpty = false;
+    // When the last probe was drawn, in ms on the effect's clock.
+    qint64 lastProbe = 0;
+    // Matching samples found by the last probe.
+    quint64 probeMatches = 0;
+    quint64 probes = 0;
+    // Frames the window was drawn without the color key because of the probe.
+    quint64 probeSkippedFrames = 0;
+
+    // Tile mask, see ColorTranslucencyTileMask. Both regions are relative to
+    // the expanded geometry the mask was drawn for and only used while that
+    // size still matches.
+    // Damage not yet drawn into the mask.
+    QRegion maskDamage;
+    // Tiles drawn into the mask whose readback is still in flight.
+    QRegion maskPending;
+    // Tiles showing a target color.
+    QRegion keyedTiles;
+    QSize maskSize;
+    bool maskValid = false;
+
+    // Offscreen memory, estimated from the expanded geometry while redirected.
+    quint64 offscreenBytes = 0;
+    quint64 peakOffscreenBytes = 0;
+    // Statistics since the window was adopted or the last reset, see
+    // get_performance_stats. Times in ns, GPU time only with timer queries.
+    quint64 framesDrawn = 0;
+    qint64 prePaintTime = 0;
+    qint64 drawTime = 0;
+    qint64 gpuTime = 0;
+    quint64 redirects = 0;
+    quint64 unredirects = 0;
+    // When the window was last drawn, in ms on the effect's clock.
+    qint64 lastDrawn = 0;
+    // ColorTranslucencySuspendReason flags, unredirected while any is set.
+    int suspended = 0;
+    // Since when the window is covered by opaque windows, -1 if it is not.
+    qint64 occludedSince = -1;
+};
@@ -22,7 +22,30 @@
 #include "kwineffects_interface.h"
 #include "ColorTranslucencyKCM.h"
 
+#include <QDBusArgument>
 #include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QMap>
+#include <utility>
+
+namespace
+{
+  const QString SERVICE = QStringLiteral("org.kde.ColorTranslucency");
+  const QString PATH = QStringLiteral("/ColorTranslucencyEffect");
+
+  QVariantMap toRecord(const QVariant &value)
+  {
+    // Maps nested in a variant arrive still marshalled
+    if (value.userType() == qMetaTypeId<QDBusArgument>())
+      return qdbus_cast<QVariantMap>(value.value<QDBusArgument>());
+    return value.toMap();
+  }
+
+  // Slider drags send at most one preview per frame
+  constexpr int PREVIEW_INTERVAL = 16;
+}
 
 ColorTranslucencyKCM::ColorTranslucencyKCM(QWidget *parent, const QVariantList &args)
     : KCModule(parent, args), ui(new Ui::Form)
@@ -54,6 +77,9 @@ ColorTranslucencyKCM::ColorTranslucencyKCM(QWidget *parent, const QVariantList &
           { updateColor(10); });
 
   connect(ui->refreshButton, &QPushButton::pressed, this, &ColorTranslucencyKCM::updateWindows);
+  subscribe();
+  updateWindows();
+  updateDegradedProfiles();
   connect(ui->includeButton, &QPushButton::pressed, [=, this]()
           {
         auto s = ui->currentWindowList->currentItem();
@@ -68,13 +94,60 @@ ColorTranslucencyKCM::ColorTranslucencyKCM(QWidget *parent, const QVariantList &
           { ui->InclusionList->takeItem(ui->InclusionList->currentRow()); });
   connect(ui->deleteExcludeButton, &QPushButton::pressed, [=, this]()
           { ui->ExclusionList->takeItem(ui->ExclusionList->currentRow()); });
+
+  m_previewTimer.setSingleShot(true);
+  m_previewTimer.setInterval(PREVIEW_INTERVAL);
+  connect(&m_previewTimer, &QTimer::timeout, this, &ColorTranslucencyKCM::sendPreview);
+  for (int i = 1; i <= 10; ++i)
+  {
+    connect(findChild<QCheckBox *>(QString("kcfg_EnableColor_%1").arg(i)), &QCheckBox::toggled, this, &ColorTranslucencyKCM::schedulePreview);
+    connect(findChild<KColorButton *>(QString("kcfg_TargetColor_%1").arg(i)), &KColorButton::changed, this, &ColorTranslucencyKCM::schedulePreview);
+    connect(findChild<KGradientSelector *>(QString("kcfg_TargetAlpha_%1").arg(i)), &KGradientSelector::valueChanged, this, &ColorTranslucencyKCM::schedulePreview);
+  }
+  connect(ui->kcfg_ExtraTargetColors, &KEditListWidget::changed, this, &ColorTranslucencyKCM::schedulePreview);
 }
 
 ColorTranslucencyKCM::~ColorTranslucencyKCM()
 {
+  // Closed without saving
+  endPreview();
   delete ui;
 }
 
+void ColorTranslucencyKCM::schedulePreview()
+{
+  if (!m_previewTimer.isActive())
+    m_previewTimer.start();
+}
+
+void ColorTranslucencyKCM::sendPreview()
+{
+  QStringList targets;
+  for (int i = 1; i <= 10; ++i)
+  {
+    const auto enabled = findChild<QCheckBox *>(QString("kcfg_EnableColor_%1").arg(i));
+    const auto color = findChild<KColorButton *>(QString("kcfg_TargetColor_%1").arg(i));
+    const auto alpha = findChild<KGradientSelector *>(QString("kcfg_TargetAlpha_%1").arg(i));
+    if (enabled && color && alpha && enabled->isChecked())
+      targets.push_back(QStringLiteral("%1 %2").arg(color->color().name()).arg(alpha->value()));
+  }
+  targets += ui->kcfg_ExtraTargetColors->items();
+
+  // No reply is waited for, the effect applies the last one it got each frame
+  auto message = QDBusMessage::createMethodCall(SERVICE, PATH, QString(), QStringLiteral("preview_targets"));
+  message << targets;
+  QDBusConnection::sessionBus().send(message);
+  m_previewing = true;
+}
+
+void ColorTranslucencyKCM::endPreview()
+{
+  m_previewTimer.stop();
+  if (!std::exchange(m_previewing, false))
+    return;
+  QDBusConnection::sessionBus().send(QDBusMessage::createMethodCall(SERVICE, PATH, QString(), QStringLiteral("end_preview")));
+}
+
 void ColorTranslucencyKCM::updateColor(int index)
 {
   qDebug() << "ColorTranslucencyKCM::updateColor" << index;
@@ -108,31 +181,111 @@ void ColorTranslucencyKCM::updateColor(int index)
   }
 }
 
+void ColorTranslucencyKCM::subscribe()
+{
+  // Subscribed before the first fetch, a record sent in between is part of the reply as well
+  auto connection = QDBusConnection::sessionBus();
+  connection.connect(SERVICE, PATH, QString(), QStringLiteral("windowAdded"), this, SLOT(windowAdded(QVariantMap)));
+  connection.connect(SERVICE, PATH, QString(), QStringLiteral("windowRemoved"), this, SLOT(windowRemoved(uint)));
+  connection.connect(SERVICE, PATH, QString(), QStringLiteral("matchChanged"), this, SLOT(matchChanged(QVariantMap)));
+  connection.connect(SERVICE, PATH, QString(), QStringLiteral("degradedProfilesChanged"), this, SLOT(degradedProfilesChanged(QStringList)));
+}
+
 void ColorTranslucencyKCM::updateWindows()
 {
+  // Only a resync, the signals keep the list current
+  const auto message = QDBusMessage::createMethodCall(SERVICE, PATH, QString(), QStringLiteral("get_windows"));
+  auto *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(message), this);
+  connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *watcher)
+          {
+        QDBusPendingReply<QVariantList> reply = *watcher;
+        watcher->deleteLater();
+        if (reply.isError())
+        {
+          qDebug() << "ColorTranslucencyKCM::updateWindows:" << reply.error().message();
+          return;
+        }
 
-  QList<QString> windowList;
-  ui->currentWindowList->clear();
+        m_windows.clear();
+        for (const QVariant &value : reply.value())
+        {
+          const QVariantMap record = toRecord(value);
+          m_windows.insert(record.value(QStringLiteral("id")).toUInt(), record);
+        }
+        qDebug() << "ColorTranslucencyKCM::updateWindows: received" << m_windows.size() << "windows";
+        showWindows(); });
+}
 
-  auto connection = QDBusConnection::sessionBus();
-  if (connection.isConnected())
+void ColorTranslucencyKCM::windowAdded(const QVariantMap &window)
+{
+  m_windows.insert(window.value(QStringLiteral("id")).toUInt(), window);
+  showWindows();
+}
+
+void ColorTranslucencyKCM::windowRemoved(uint id)
+{
+  if (m_windows.remove(id))
+    showWindows();
+}
+
+void ColorTranslucencyKCM::matchChanged(const QVariantMap &window)
+{
+  windowAdded(window);
+}
+
+void ColorTranslucencyKCM::updateDegradedProfiles()
+{
+  const auto message = QDBusMessage::createMethodCall(SERVICE, PATH, QString(), QStringLiteral("get_shader_counters"));
+  auto *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(message), this);
+  connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *watcher)
+          {
+        QDBusPendingReply<QVariantMap> reply = *watcher;
+        watcher->deleteLater();
+        if (reply.isError())
+        {
+          qDebug() << "ColorTranslucencyKCM::updateDegradedProfiles:" << reply.error().message();
+          return;
+        }
+        degradedProfilesChanged(reply.value().value(QStringLiteral("degradedProfiles")).toStringList()); });
+}
+
+void ColorTranslucencyKCM::degradedProfilesChanged(const QStringList &profiles)
+{
+  QStringList names;
+  for (const QString &profile : profiles)
+    names.push_back(profile.isEmpty() ? QStringLiteral("the global colors") : QStringLiteral("\"%1\"").arg(profile));
+
+  ui->degradedProfilesLabel->setVisible(!names.isEmpty());
+  ui->degradedProfilesLabel->setText(QStringLiteral("Too many colors lie close together for the lookup texture, or it is not available. "
+                                                    "Only the first 10 colors of %1 are matched.").arg(names.join(QStringLiteral(", "))));
+}
+
+void ColorTranslucencyKCM::showWindows()
+{
+  // One entry per class, the lists match classes and not single windows
+  QMap<QString, QVariantMap> classes;
+  for (const auto &record : std::as_const(m_windows))
   {
-    QDBusInterface interface("org.kde.ColorTranslucency", "/ColorTranslucencyEffect");
-    if (interface.isValid())
-    {
-      QDBusReply<QString> reply = interface.call("get_window_titles");
-      if (reply.isValid())
-        windowList = reply.value().split("\n");
-      qInfo() << "ColorTranslucencyKCM::updateWindows: windowList:" << windowList;
-    }
+    const QString windowClass = record.value(QStringLiteral("class")).toString();
+    if (!windowClass.isEmpty() && !record.value(QStringLiteral("special")).toBool() && !classes.contains(windowClass))
+      classes.insert(windowClass, record);
   }
 
-  for (const auto &w : windowList)
-    if (!w.isEmpty())
-    {
-      ui->currentWindowList->addItem(w);
-      qInfo() << "ColorTranslucencyKCM::updateWindows: adding window:" << w;
-    }
+  const auto current = ui->currentWindowList->currentItem();
+  const QString selected = current ? current->text() : QString();
+  ui->currentWindowList->clear();
+  for (auto it = classes.cbegin(); it != classes.cend(); ++it)
+  {
+    const QString rule = it->value(QStringLiteral("rule")).toString();
+    QString toolTip = it->value(QStringLiteral("included")).toBool() ? QStringLiteral("Included") : QStringLiteral("Not included");
+    if (!rule.isEmpty())
+      toolTip += QStringLiteral(" by %1").arg(rule);
+
+    auto item = new QListWidgetItem(it.key(), ui->currentWindowList);
+    item->setToolTip(toolTip);
+    if (it.key() == selected)
+      ui->currentWindowList->setCurrentItem(item);
+  }
 }
 
 void ColorTranslucencyKCM::save()
@@ -152,11 +305,16 @@ void ColorTranslucencyKCM::save()
                                        QStringLiteral("/Effects"),
                                        QDBusConnection::sessionBus());
   interface.reconfigureEffect(QStringLiteral("kwin4_effect_colortranslucency"));
+  // The reconfigure replaces the preview with what was just saved
+  m_previewTimer.stop();
+  m_previewing = false;
 }
 
 void ColorTranslucencyKCM::load()
 {
   KCModule::load();
+  // Loading set the widgets back to the saved values
+  endPreview();
   ColorTranslucencyConfig::self()->load();
   ui->InclusionList->addItems(ColorTranslucencyConfig::inclusionList());
   ui->ExclusionList->addItems(ColorTranslucencyConfig::exclusionList());
@@ -21,6 +21,9 @@
  */
 
 #include <kcmodule.h>
+#include <QHash>
+#include <QTimer>
+#include <QVariantMap>
 #include "ui_ColorTranslucencyKCM.h"
 #include "ColorTranslucencyConfig.h"
 
@@ -36,10 +39,29 @@ public slots:
     void load() override;
     void save() override;
     void updateColor(int);
-    void updateWindows();  
+    void updateWindows();
+
+private slots:
+    // Pushed by the effect, see ColorTranslucencyEffect::get_windows
+    void windowAdded(const QVariantMap &window);
+    void windowRemoved(uint id);
+    void matchChanged(const QVariantMap &window);
+    void degradedProfilesChanged(const QStringList &profiles);
 
 private:
+    void subscribe();
+    void showWindows();
+    void updateDegradedProfiles();
+    void schedulePreview();
+    void sendPreview();
+    void endPreview();
+
     Ui::Form *ui;
+    // Records of the windows the effect knows about, by window id
+    QHash<uint, QVariantMap> m_windows;
+    // Unsaved color edits are shown live through the effect's preview_targets
+    QTimer m_previewTimer;
+    bool m_previewing = false;
 
     QColor m_color1;
     QColor m_color2;
@@ -30,6 +30,27 @@ void main() {
 
     vec4 tex = texture2D(sampler, texcoord0);
 
+#ifdef PROBE
+    // Coverage probe, only fragments showing a target color pass
+    bool matched = false;
+    for(int i = 0; i < numberOfColors; ++i) {
+        if(tex.rgb == targetColor[i].rgb) {
+            matched = true;
+        }
+    }
+    if(!matched) {
+        discard;
+    }
+    gl_FragColor = vec4(1.0); // Read back as the tile mask
+    return;
+#endif
+
+#ifdef NUMBER_OF_COLORS
+    // Specialized variant, ColorTranslucencyShaderSource generates MATCH_CHAIN
+#if NUMBER_OF_COLORS > 0
+    MATCH_CHAIN
+#endif
+#else
     for(int i = 0; i < numberOfColors; ++i) {
 
         if(tex.rgb == targetColor[i].rgb) {
@@ -37,6 +58,7 @@ void main() {
             break; // Exit the loop early since we found a match
         }
     }
+#endif
 
     tex.rgb *= tex.a; // Premultiply color by alpha
     gl_FragColor = tex; // Set the final color of the pixel
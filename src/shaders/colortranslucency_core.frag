@@ -31,12 +31,32 @@ void main() {
 
   vec4 tex = texture(sampler, texcoord0);
 
+#ifdef PROBE
+  // Coverage probe, only fragments showing a target color pass
+  bool matched = false;
+  for(int i = 0; i < numberOfColors; ++i) {
+    matched = matched || tex.rgb == targetColor[i].rgb;
+  }
+  if(!matched) {
+    discard;
+  }
+  fragColor = vec4(1.0); // Read back as the tile mask
+  return;
+#endif
+
+#ifdef NUMBER_OF_COLORS
+  // Specialized variant, ColorTranslucencyShaderSource generates MATCH_CHAIN
+#if NUMBER_OF_COLORS > 0
+  MATCH_CHAIN
+#endif
+#else
   for(int i = 0; i < numberOfColors; ++i) {
     if(tex.rgb == targetColor[i].rgb) {
       tex.a = targetAlpha[i];
       break;
     }
   }
+#endif
 
   tex.rgb *= tex.a;
   fragColor = tex;
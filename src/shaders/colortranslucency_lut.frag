@@ -0,0 +1,63 @@
+/*
+ * Modifications to support color translucency effect.
+ * Copyright (c) 2023 Aaron Kirschen
+ * 
+ * This file is part of Color Translucency Effect.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#version 140
+
+#ifdef GL_ES
+precision highp sampler3D;
+#endif
+
+#define MAX_CHAIN 4 // Must match ColorTranslucencyLut::MAX_CHAIN
+#define ROW_WIDTH 1024 // Must match ColorTranslucencyLut::ROW_WIDTH
+
+uniform sampler2D sampler;
+uniform sampler3D lookupTable;   // index + 1 of the first node of each RGB cell
+uniform sampler2D lookupEntries; // even rows: rgb + alpha, odd rows: tolerance + next node
+
+in vec2 texcoord0;
+out vec4 fragColor;
+
+void main() {
+
+  vec4 tex = texture(sampler, texcoord0);
+
+  bool matched = false;
+  int node = int(texture(lookupTable, tex.rgb).r) - 1;
+  for(int i = 0; i < MAX_CHAIN && node >= 0; ++i) {
+    ivec2 at = ivec2(node % ROW_WIDTH, 2 * (node / ROW_WIDTH));
+    vec4 target = texelFetch(lookupEntries, at, 0);
+    vec4 link = texelFetch(lookupEntries, at + ivec2(0, 1), 0);
+    if(distance(tex.rgb, target.rgb) <= link.r) {
+      tex.a = target.a;
+      matched = true;
+      break;
+    }
+    node = int(link.g) - 1;
+  }
+
+#ifdef PROBE
+  // Coverage probe, only fragments showing a target color pass
+  if(!matched) {
+    discard;
+  }
+  fragColor = vec4(1.0); // Read back as the tile mask
+  return;
+#endif
+
+  tex.rgb *= tex.a;
+  fragColor = tex;
+}